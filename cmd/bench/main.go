@@ -0,0 +1,382 @@
+// bench is a load generator for the sandbox. It runs the real server
+// in-process, or targets a running one with -url, replays a weighted mix of
+// snippets with a fixed number of concurrent clients and writes a JSON report
+// with throughput, latency percentiles and error, rejection and timeout rates.
+// The report goes to a file, the in-process server logs to stdout.
+//
+// The in-process server only prepares the host like the server does with
+// -setup: it moves the bench process into a cgroup child, creates the
+// sandbox cgroups and syncs the sandbox environments under LIB_PATH.
+// Without it python runs are rejected until an environment was synced, use
+// -url to measure a running server instead.
+//
+//	sudo go run ./cmd/bench -setup -concurrency 16 -duration 30s
+//	go run ./cmd/bench -mix '[{"language":"python3","kind":"cpu","work":1000000}]' -requests 200
+package main
+
+import (
+	"bytes"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"log/slog"
+	"math/rand"
+	"net/http"
+	"net/http/httptest"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/gin-gonic/gin"
+	"github.com/langgenius/dify-sandbox/internal/controller"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/nodejs"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/python"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/uidpool"
+	"github.com/langgenius/dify-sandbox/internal/static"
+)
+
+const (
+	outcomeOK       = "ok"
+	outcomeError    = "error"
+	outcomeRejected = "rejected"
+	outcomeTimeout  = "timeout"
+)
+
+type sample struct {
+	scenario string
+	outcome  string
+	latency  time.Duration
+}
+
+type Latency struct {
+	P50  float64 `json:"p50"`
+	P95  float64 `json:"p95"`
+	P99  float64 `json:"p99"`
+	Max  float64 `json:"max"`
+	Mean float64 `json:"mean"`
+}
+
+// Stats are the outcomes of a set of requests. Every request has exactly one
+// outcome: errors are transport failures, non-200 answers and runs which
+// failed or exited non-zero, rejections are requests the server refused to
+// queue, timeouts are runs killed by the run timeout.
+type Stats struct {
+	Requests     int     `json:"requests"`
+	Errors       int     `json:"errors"`
+	Rejected     int     `json:"rejected"`
+	Timeouts     int     `json:"timeouts"`
+	ErrorRate    float64 `json:"error_rate"`
+	RejectedRate float64 `json:"rejected_rate"`
+	TimeoutRate  float64 `json:"timeout_rate"`
+	// in milliseconds, over all requests whatever their outcome
+	Latency Latency `json:"latency_ms"`
+}
+
+type Report struct {
+	Target      string `json:"target"`
+	Concurrency int    `json:"concurrency"`
+	// in seconds
+	Duration      float64 `json:"duration"`
+	ThroughputRPS float64 `json:"throughput_rps"`
+	Stats
+	Scenarios map[string]*Stats `json:"scenarios"`
+}
+
+type client struct {
+	url     string
+	key     string
+	http    *http.Client
+	mix     []Scenario
+	weights int
+	// add a nonce to every snippet to defeat the code cache
+	unique bool
+	seq    atomic.Int64
+}
+
+func main() {
+	configPath := flag.String("config", "conf/config.yaml", "config of the in-process server")
+	url := flag.String("url", "", "base url of a running server, the server runs in-process when empty")
+	setup := flag.Bool("setup", false, "set up cgroups and the sandbox environments for the in-process server like the server does")
+	key := flag.String("key", "", "api key of the server given with -url")
+	mixFlag := flag.String("mix", "", "JSON array of scenarios or @file, see Scenario, defaults to a python3 and nodejs mix")
+	concurrency := flag.Int("concurrency", 8, "concurrent clients")
+	requests := flag.Int("requests", 0, "measured requests, 500 when neither -requests nor -duration is given")
+	duration := flag.Duration("duration", 0, "measure for this long instead of a number of requests")
+	warmup := flag.Int("warmup", 0, "requests sent before measuring")
+	timeout := flag.Duration("timeout", time.Minute, "http timeout of a request")
+	seed := flag.Int64("seed", 1, "seed of the scenario picks")
+	unique := flag.Bool("unique", false, "make every snippet unique so that no run hits the code cache")
+	out := flag.String("out", "bench.json", "file the report is written to, - for stdout")
+	flag.Parse()
+
+	if *requests == 0 && *duration == 0 {
+		*requests = 500
+	}
+	if *concurrency <= 0 {
+		fail("-concurrency must be positive")
+	}
+
+	mix, err := parseMix(*mixFlag)
+	if err != nil {
+		fail(err.Error())
+	}
+
+	target := *url
+	apiKey := *key
+	if target == "" {
+		target, apiKey, err = startServer(*configPath, *setup)
+		if err != nil {
+			fail(err.Error())
+		}
+	}
+
+	c := &client{
+		url:    strings.TrimSuffix(target, "/") + "/v1/sandbox/run",
+		key:    apiKey,
+		mix:    mix,
+		unique: *unique,
+		http: &http.Client{
+			Timeout:   *timeout,
+			Transport: &http.Transport{MaxIdleConnsPerHost: *concurrency},
+		},
+	}
+	for _, s := range mix {
+		c.weights += s.Weight
+	}
+
+	if *warmup > 0 {
+		slog.Info("warming up", "requests", *warmup)
+		c.load(*concurrency, *warmup, 0, *seed-1)
+	}
+
+	slog.Info("measuring", "concurrency", *concurrency, "requests", *requests, "duration", *duration)
+	start := time.Now()
+	samples := c.load(*concurrency, *requests, *duration, *seed)
+	elapsed := time.Since(start)
+
+	report := Report{
+		Target:        target,
+		Concurrency:   *concurrency,
+		Duration:      elapsed.Seconds(),
+		ThroughputRPS: float64(len(samples)) / elapsed.Seconds(),
+		Stats:         summarize(samples),
+		Scenarios:     map[string]*Stats{},
+	}
+	byScenario := map[string][]sample{}
+	for _, s := range samples {
+		byScenario[s.scenario] = append(byScenario[s.scenario], s)
+	}
+	for name, samples := range byScenario {
+		stats := summarize(samples)
+		report.Scenarios[name] = &stats
+	}
+
+	writer := os.Stdout
+	if *out != "-" {
+		writer, err = os.Create(*out)
+		if err != nil {
+			fail(err.Error())
+		}
+		defer writer.Close()
+	}
+	encoder := json.NewEncoder(writer)
+	encoder.SetIndent("", "  ")
+	if err := encoder.Encode(report); err != nil {
+		fail(err.Error())
+	}
+	slog.Info("benchmark finished", "report", *out, "throughput_rps", report.ThroughputRPS, "p99_ms", report.Latency.P99)
+}
+
+func fail(message string) {
+	fmt.Fprintln(os.Stderr, message)
+	os.Exit(1)
+}
+
+// startServer serves the sandbox routes in-process. With setup the host is
+// prepared like the server does, minus installing dependencies. It returns
+// the base url and the api key.
+func startServer(configPath string, setup bool) (string, string, error) {
+	if err := static.InitConfig(configPath); err != nil {
+		return "", "", fmt.Errorf("failed to init config: %w", err)
+	}
+	config := static.GetDifySandboxGlobalConfigurations()
+
+	if setup {
+		cgroup.Init(config, uidpool.MinUID, uidpool.MaxUID)
+
+		if err := nodejs.PrepareSandboxRootfs(); err != nil {
+			return "", "", fmt.Errorf("failed to initialize nodejs sandbox root: %w", err)
+		}
+		if err := python.PreparePythonDependenciesEnv(); err != nil {
+			return "", "", fmt.Errorf("failed to initialize python dependencies sandbox: %w", err)
+		}
+		python.StartZygotes()
+	}
+
+	gin.SetMode(gin.ReleaseMode)
+	r := gin.New()
+	r.Use(gin.Recovery())
+	controller.Setup(r)
+
+	server := httptest.NewServer(r)
+	return server.URL, config.App.Key, nil
+}
+
+// load keeps concurrency requests in flight until requests were sent or
+// duration passed, whichever is set and comes first. Requests in flight at
+// the end are waited for.
+func (c *client) load(concurrency int, requests int, duration time.Duration, seed int64) []sample {
+	var deadline time.Time
+	if duration > 0 {
+		deadline = time.Now().Add(duration)
+	}
+
+	issued := atomic.Int64{}
+	samples := []sample{}
+	lock := sync.Mutex{}
+	wg := sync.WaitGroup{}
+
+	for worker := 0; worker < concurrency; worker++ {
+		wg.Add(1)
+		go func(rng *rand.Rand) {
+			defer wg.Done()
+			for {
+				if requests > 0 && issued.Add(1) > int64(requests) {
+					return
+				}
+				if !deadline.IsZero() && time.Now().After(deadline) {
+					return
+				}
+
+				s := c.do(c.pick(rng))
+
+				lock.Lock()
+				samples = append(samples, s)
+				lock.Unlock()
+			}
+		}(rand.New(rand.NewSource(seed + int64(worker))))
+	}
+
+	wg.Wait()
+	return samples
+}
+
+func (c *client) pick(rng *rand.Rand) *Scenario {
+	n := rng.Intn(c.weights)
+	for i := range c.mix {
+		n -= c.mix[i].Weight
+		if n < 0 {
+			return &c.mix[i]
+		}
+	}
+	return &c.mix[len(c.mix)-1]
+}
+
+func (c *client) do(scenario *Scenario) sample {
+	nonce := ""
+	if c.unique {
+		nonce = "bench " + strconv.FormatInt(c.seq.Add(1), 10)
+	}
+
+	body, _ := json.Marshal(map[string]any{
+		"language":       scenario.Language,
+		"code":           scenario.Code(nonce),
+		"enable_network": scenario.Network,
+	})
+
+	start := time.Now()
+	outcome := c.send(body)
+	return sample{
+		scenario: scenario.Name,
+		outcome:  outcome,
+		latency:  time.Since(start),
+	}
+}
+
+func (c *client) send(body []byte) string {
+	req, err := http.NewRequest(http.MethodPost, c.url, bytes.NewReader(body))
+	if err != nil {
+		return outcomeError
+	}
+	req.Header.Set("Content-Type", "application/json")
+	req.Header.Set("X-Api-Key", c.key)
+
+	resp, err := c.http.Do(req)
+	if err != nil {
+		return outcomeError
+	}
+	defer resp.Body.Close()
+
+	var envelope struct {
+		Code int `json:"code"`
+		Data *struct {
+			Error    string `json:"error"`
+			ExitCode int    `json:"exit_code"`
+		} `json:"data"`
+	}
+	if err := json.NewDecoder(resp.Body).Decode(&envelope); err != nil {
+		return outcomeError
+	}
+
+	switch {
+	case resp.StatusCode == http.StatusServiceUnavailable || resp.StatusCode == http.StatusTooManyRequests:
+		return outcomeRejected
+	case resp.StatusCode != http.StatusOK || envelope.Code != 0 || envelope.Data == nil:
+		return outcomeError
+	case strings.Contains(envelope.Data.Error, "error: timeout"):
+		return outcomeTimeout
+	case envelope.Data.Error != "" || envelope.Data.ExitCode != 0:
+		return outcomeError
+	}
+	return outcomeOK
+}
+
+func summarize(samples []sample) Stats {
+	stats := Stats{Requests: len(samples)}
+	if len(samples) == 0 {
+		return stats
+	}
+
+	latencies := make([]time.Duration, 0, len(samples))
+	total := time.Duration(0)
+	for _, s := range samples {
+		switch s.outcome {
+		case outcomeError:
+			stats.Errors++
+		case outcomeRejected:
+			stats.Rejected++
+		case outcomeTimeout:
+			stats.Timeouts++
+		}
+		latencies = append(latencies, s.latency)
+		total += s.latency
+	}
+	sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+
+	n := float64(len(samples))
+	stats.ErrorRate = float64(stats.Errors) / n
+	stats.RejectedRate = float64(stats.Rejected) / n
+	stats.TimeoutRate = float64(stats.Timeouts) / n
+	stats.Latency = Latency{
+		P50:  milliseconds(percentile(latencies, 0.50)),
+		P95:  milliseconds(percentile(latencies, 0.95)),
+		P99:  milliseconds(percentile(latencies, 0.99)),
+		Max:  milliseconds(latencies[len(latencies)-1]),
+		Mean: milliseconds(total / time.Duration(len(latencies))),
+	}
+	return stats
+}
+
+// percentile of sorted latencies, nearest rank.
+func percentile(sorted []time.Duration, p float64) time.Duration {
+	return sorted[int(p*float64(len(sorted)-1))]
+}
+
+func milliseconds(d time.Duration) float64 {
+	return float64(d) / float64(time.Millisecond)
+}
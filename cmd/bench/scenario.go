@@ -0,0 +1,156 @@
+package main
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"strings"
+)
+
+// Scenario is one kind of snippet in the load mix, picked with a probability
+// proportional to its weight.
+type Scenario struct {
+	Name     string `json:"name"`
+	Language string `json:"language"`
+	// cpu, sleep, output or noop
+	Kind    string `json:"kind"`
+	Network bool   `json:"network"`
+	// loop iterations of a cpu snippet
+	Work int `json:"work"`
+	// sleep of a sleep snippet in milliseconds
+	SleepMs int `json:"sleep_ms"`
+	// bytes written to stdout by an output snippet
+	OutputBytes int `json:"output_bytes"`
+	Weight      int `json:"weight"`
+}
+
+var defaultMix = []Scenario{
+	{Language: "python3", Kind: "noop", Weight: 2},
+	{Language: "python3", Kind: "cpu", Work: 200000, Weight: 2},
+	{Language: "python3", Kind: "sleep", SleepMs: 100, Weight: 1},
+	{Language: "python3", Kind: "output", OutputBytes: 64 << 10, Weight: 1},
+	{Language: "python3", Kind: "noop", Network: true, Weight: 1},
+	{Language: "nodejs", Kind: "noop", Weight: 2},
+	{Language: "nodejs", Kind: "cpu", Work: 2000000, Weight: 2},
+	{Language: "nodejs", Kind: "sleep", SleepMs: 100, Weight: 1},
+	{Language: "nodejs", Kind: "output", OutputBytes: 64 << 10, Weight: 1},
+}
+
+// parseMix reads the mix from a JSON array, inline or from a file given as
+// @path.
+func parseMix(value string) ([]Scenario, error) {
+	if value == "" {
+		return normalizeMix(append([]Scenario(nil), defaultMix...))
+	}
+
+	data := []byte(value)
+	if path, ok := strings.CutPrefix(value, "@"); ok {
+		var err error
+		data, err = os.ReadFile(path)
+		if err != nil {
+			return nil, err
+		}
+	}
+
+	mix := []Scenario{}
+	if err := json.Unmarshal(data, &mix); err != nil {
+		return nil, fmt.Errorf("invalid mix: %w", err)
+	}
+	return normalizeMix(mix)
+}
+
+func normalizeMix(mix []Scenario) ([]Scenario, error) {
+	if len(mix) == 0 {
+		return nil, errors.New("empty mix")
+	}
+
+	names := map[string]bool{}
+	for i := range mix {
+		s := &mix[i]
+		if s.Language != "python3" && s.Language != "nodejs" {
+			return nil, fmt.Errorf("unsupported language %q", s.Language)
+		}
+		if s.Weight <= 0 {
+			s.Weight = 1
+		}
+		switch s.Kind {
+		case "noop":
+		case "cpu":
+			if s.Work <= 0 {
+				s.Work = 100000
+			}
+		case "sleep":
+			if s.SleepMs <= 0 {
+				s.SleepMs = 100
+			}
+		case "output":
+			if s.OutputBytes <= 0 {
+				s.OutputBytes = 1024
+			}
+		default:
+			return nil, fmt.Errorf("unsupported kind %q", s.Kind)
+		}
+		if s.Name == "" {
+			s.Name = s.defaultName()
+		}
+		if names[s.Name] {
+			return nil, fmt.Errorf("duplicate scenario %q", s.Name)
+		}
+		names[s.Name] = true
+	}
+	return mix, nil
+}
+
+func (s *Scenario) defaultName() string {
+	name := s.Language + "/" + s.Kind
+	switch s.Kind {
+	case "cpu":
+		name += fmt.Sprintf("/%d", s.Work)
+	case "sleep":
+		name += fmt.Sprintf("/%dms", s.SleepMs)
+	case "output":
+		name += fmt.Sprintf("/%dB", s.OutputBytes)
+	}
+	if s.Network {
+		name += "/network"
+	}
+	return name
+}
+
+// Code is the snippet of the scenario. A non-empty nonce is added as a comment
+// so the snippet misses the compiled code cache.
+func (s *Scenario) Code(nonce string) string {
+	code := ""
+	switch s.Language {
+	case "python3":
+		switch s.Kind {
+		case "noop":
+			code = "print('ok')\n"
+		case "cpu":
+			code = fmt.Sprintf("n = 0\nfor i in range(%d):\n    n += i * i\nprint(n)\n", s.Work)
+		case "sleep":
+			code = fmt.Sprintf("import time\ntime.sleep(%g)\nprint('ok')\n", float64(s.SleepMs)/1000)
+		case "output":
+			code = fmt.Sprintf("import sys\nsys.stdout.write('x' * %d)\n", s.OutputBytes)
+		}
+		if nonce != "" {
+			code += "# " + nonce + "\n"
+		}
+	case "nodejs":
+		switch s.Kind {
+		case "noop":
+			code = "console.log('ok')\n"
+		case "cpu":
+			code = fmt.Sprintf("let n = 0\nfor (let i = 0; i < %d; i++) {\n    n += i * i\n}\nconsole.log(n)\n", s.Work)
+		case "sleep":
+			code = fmt.Sprintf("setTimeout(() => console.log('ok'), %d)\n", s.SleepMs)
+		case "output":
+			code = fmt.Sprintf("process.stdout.write('x'.repeat(%d))\n", s.OutputBytes)
+		}
+		if nonce != "" {
+			code += "// " + nonce + "\n"
+		}
+	}
+	return code
+}
@@ -1,8 +1,14 @@
 package controller
 
 import (
+	"net/http"
+	"strconv"
+	"time"
+
 	"github.com/gin-gonic/gin"
+	"github.com/langgenius/dify-sandbox/internal/middleware"
 	"github.com/langgenius/dify-sandbox/internal/types"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
 func BindRequest[T any](r *gin.Context, success func(T)) {
@@ -23,3 +29,31 @@ func BindRequest[T any](r *gin.Context, success func(T)) {
 	}
 	success(request)
 }
+
+// unavailableRetryAfter is the Retry-After of a run refused because the
+// sandbox is still starting, e.g. the python environment is not prepared yet.
+const unavailableRetryAfter = 5 * time.Second
+
+// respondRun answers a run request. A -503 response is retryable and sent
+// with its HTTP status, every other response keeps the 200 envelope.
+func respondRun(c *gin.Context, resp *types.DifySandboxResponse) {
+	if resp.Code == -503 {
+		c.Header("Retry-After", strconv.Itoa(int(unavailableRetryAfter.Seconds())))
+		c.JSON(http.StatusServiceUnavailable, resp)
+		return
+	}
+	c.JSON(200, resp)
+}
+
+// observeWorkerWait records the time spent in MaxWorker, which runs before
+// the language is known. Unsupported languages are skipped to keep the
+// label set bounded.
+func observeWorkerWait(c *gin.Context, language string) {
+	if language != metrics.LanguagePython3 && language != metrics.LanguageNodeJs {
+		return
+	}
+
+	if wait, ok := c.Get(middleware.WorkerWaitKey); ok {
+		metrics.ObservePhase(language, metrics.PhaseWorkerWait, wait.(time.Duration))
+	}
+}
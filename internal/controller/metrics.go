@@ -0,0 +1,15 @@
+package controller
+
+import (
+	"net/http"
+
+	"github.com/gin-gonic/gin"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
+)
+
+// MetricsController serves the sandbox metrics in the Prometheus text format.
+func MetricsController(c *gin.Context) {
+	c.Header("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+	c.Status(http.StatusOK)
+	metrics.DefaultRegistry.WriteText(c.Writer)
+}
@@ -2,6 +2,7 @@ package controller
 
 import (
 	"net/http"
+	"time"
 
 	"github.com/gin-gonic/gin"
 	"github.com/langgenius/dify-sandbox/internal/middleware"
@@ -21,6 +22,10 @@ func Setup(Router *gin.Engine) {
 		})
 	}
 
+	// queue depth, uid usage and seccomp kills are not for everyone, scrapers
+	// send the api key in X-Api-Key like every other client
+	Router.GET("/metrics", middleware.Auth(), MetricsController)
+
 	InitRunRouter(PrivateGroup)
 	InitDependencyRouter(PrivateGroup)
 }
@@ -35,14 +40,40 @@ func InitDependencyRouter(Router *gin.RouterGroup) {
 }
 
 func InitRunRouter(Router *gin.RouterGroup) {
+	configuration := static.GetDifySandboxGlobalConfigurations()
+
+	// shared by all run endpoints so that they draw from the same workers
+	scheduler := middleware.NewScheduler(middleware.SchedulerOptions{
+		MaxWorkers:      configuration.MaxWorkers,
+		MaxRequests:     configuration.MaxRequests,
+		MaxQueueWait:    time.Duration(configuration.Scheduler.MaxQueueWait) * time.Second,
+		LanguageWorkers: configuration.Scheduler.LanguageWorkers,
+		Adaptive:        configuration.Scheduler.Adaptive,
+		RunTimeout:      time.Duration(configuration.WorkerTimeout) * time.Second,
+		BatchRunTimeout: time.Duration(configuration.BatchTimeout) * time.Second,
+	})
+	schedule := middleware.Schedule(scheduler, configuration.Scheduler.TenantHeader, configuration.Scheduler.TimeoutHeader)
+	scheduleBatch := middleware.ScheduleBatch(scheduler, configuration.Scheduler.TenantHeader, configuration.Scheduler.TimeoutHeader)
+
 	runRouter := Router.Group("")
 	{
 		runRouter.POST(
 			"run",
-			middleware.MaxRequest(static.GetDifySandboxGlobalConfigurations().MaxRequests),
-			middleware.MaxWorker(static.GetDifySandboxGlobalConfigurations().MaxWorkers),
+			schedule,
 			middleware.TraceMiddleware(),
 			RunSandboxController,
 		)
+		runRouter.POST(
+			"run/stream",
+			schedule,
+			middleware.TraceMiddleware(),
+			RunSandboxStreamController,
+		)
+		runRouter.POST(
+			"run/batch",
+			scheduleBatch,
+			middleware.TraceMiddleware(),
+			RunSandboxBatchController,
+		)
 	}
 }
@@ -1,6 +1,8 @@
 package controller
 
 import (
+	"encoding/json"
+
 	"github.com/gin-gonic/gin"
 	runner_types "github.com/langgenius/dify-sandbox/internal/core/runner/types"
 	"github.com/langgenius/dify-sandbox/internal/service"
@@ -14,13 +16,15 @@ func RunSandboxController(c *gin.Context) {
 		Preload       string `json:"preload" form:"preload"`
 		EnableNetwork bool   `json:"enable_network" form:"enable_network"`
 	}) {
+		observeWorkerWait(c, req.Language)
+
 		switch req.Language {
 		case "python3":
-			c.JSON(200, service.RunPython3Code(c, req.Code, req.Preload, &runner_types.RunnerOptions{
+			respondRun(c, service.RunPython3Code(c, req.Code, req.Preload, &runner_types.RunnerOptions{
 				EnableNetwork: req.EnableNetwork,
 			}))
 		case "nodejs":
-			c.JSON(200, service.RunNodeJsCode(c, req.Code, req.Preload, &runner_types.RunnerOptions{
+			respondRun(c, service.RunNodeJsCode(c, req.Code, req.Preload, &runner_types.RunnerOptions{
 				EnableNetwork: req.EnableNetwork,
 			}))
 		default:
@@ -29,6 +33,80 @@ func RunSandboxController(c *gin.Context) {
 	})
 }
 
+// RunSandboxStreamController streams stdout and stderr as NDJSON frames while
+// the code runs, followed by a single result frame. Failures before the
+// process started are answered with the regular JSON envelope.
+func RunSandboxStreamController(c *gin.Context) {
+	BindRequest(c, func(req struct {
+		Language      string `json:"language" form:"language" binding:"required"`
+		Code          string `json:"code" form:"code" binding:"required"`
+		Preload       string `json:"preload" form:"preload"`
+		EnableNetwork bool   `json:"enable_network" form:"enable_network"`
+	}) {
+		observeWorkerWait(c, req.Language)
+
+		encoder := json.NewEncoder(c.Writer)
+		emit := func(frame *service.RunCodeFrame) error {
+			if !c.Writer.Written() {
+				c.Header("Content-Type", "application/x-ndjson")
+				c.Header("X-Content-Type-Options", "nosniff")
+				c.Status(200)
+			}
+			if err := encoder.Encode(frame); err != nil {
+				return err
+			}
+			c.Writer.Flush()
+			return nil
+		}
+
+		options := &runner_types.RunnerOptions{
+			EnableNetwork: req.EnableNetwork,
+		}
+
+		var resp *types.DifySandboxResponse
+		switch req.Language {
+		case "python3":
+			resp = service.StreamPython3Code(c.Request.Context(), req.Code, req.Preload, options, emit)
+		case "nodejs":
+			resp = service.StreamNodeJsCode(c.Request.Context(), req.Code, req.Preload, options, emit)
+		default:
+			c.JSON(400, types.ErrorResponse(-400, "unsupported language"))
+			return
+		}
+
+		if resp != nil {
+			respondRun(c, resp)
+		}
+	})
+}
+
+// RunSandboxBatchController runs one snippet against every input in a single
+// sandbox process and answers with one result per input.
+func RunSandboxBatchController(c *gin.Context) {
+	BindRequest(c, func(req struct {
+		Language      string   `json:"language" form:"language" binding:"required"`
+		Code          string   `json:"code" form:"code" binding:"required"`
+		Inputs        []string `json:"inputs" form:"inputs" binding:"required,min=1,max=1000"`
+		Preload       string   `json:"preload" form:"preload"`
+		EnableNetwork bool     `json:"enable_network" form:"enable_network"`
+	}) {
+		observeWorkerWait(c, req.Language)
+
+		options := &runner_types.RunnerOptions{
+			EnableNetwork: req.EnableNetwork,
+		}
+
+		switch req.Language {
+		case "python3":
+			respondRun(c, service.RunPython3Batch(c, req.Code, req.Inputs, req.Preload, options))
+		case "nodejs":
+			respondRun(c, service.RunNodeJsBatch(c, req.Code, req.Inputs, req.Preload, options))
+		default:
+			c.JSON(400, types.ErrorResponse(-400, "unsupported language"))
+		}
+	})
+}
+
 func GetDependencies(c *gin.Context) {
 	BindRequest(c, func(req struct {
 		Language string `json:"language" form:"language" binding:"required"`
@@ -26,27 +26,9 @@ func InitSeccomp(uid int, gid int, enable_network bool) error {
 
 	lib.SetNoNewPrivs()
 
-	allowed_syscalls := []int{}
-	allowed_not_kill_syscalls := []int{}
-	allowed_not_kill_syscalls = append(allowed_not_kill_syscalls, python_syscall.ALLOW_ERROR_SYSCALLS...)
-
-	allowed_syscall := os.Getenv("ALLOWED_SYSCALLS")
-	if allowed_syscall != "" {
-		nums := strings.Split(allowed_syscall, ",")
-		for num := range nums {
-			syscall, err := strconv.Atoi(nums[num])
-			if err != nil {
-				continue
-			}
-			allowed_syscalls = append(allowed_syscalls, syscall)
-		}
-		allowed_syscalls = append(allowed_syscalls, syscall.SYS_SETGROUPS)
-	} else {
-		allowed_syscalls = append(allowed_syscalls, python_syscall.ALLOW_SYSCALLS...)
-		if enable_network {
-			allowed_syscalls = append(allowed_syscalls, python_syscall.ALLOW_NETWORK_SYSCALLS...)
-		}
-	}
+	allowed_syscalls, allowed_not_kill_syscalls := SeccompSyscalls(
+		parseAllowedSyscalls(os.Getenv("ALLOWED_SYSCALLS")), enable_network,
+	)
 
 	err = lib.Seccomp(allowed_syscalls, allowed_not_kill_syscalls)
 	if err != nil {
@@ -72,3 +54,40 @@ func InitSeccomp(uid int, gid int, enable_network bool) error {
 
 	return nil
 }
+
+// SeccompSyscalls returns the allowed and the errno-only syscalls of the python
+// sandbox. A non-empty override replaces the built-in allow list.
+func SeccompSyscalls(override []int, enable_network bool) ([]int, []int) {
+	allowed_syscalls := []int{}
+	allowed_not_kill_syscalls := []int{}
+	allowed_not_kill_syscalls = append(allowed_not_kill_syscalls, python_syscall.ALLOW_ERROR_SYSCALLS...)
+
+	if len(override) > 0 {
+		allowed_syscalls = append(allowed_syscalls, override...)
+		allowed_syscalls = append(allowed_syscalls, syscall.SYS_SETGROUPS)
+	} else {
+		allowed_syscalls = append(allowed_syscalls, python_syscall.ALLOW_SYSCALLS...)
+		if enable_network {
+			allowed_syscalls = append(allowed_syscalls, python_syscall.ALLOW_NETWORK_SYSCALLS...)
+		}
+	}
+
+	return allowed_syscalls, allowed_not_kill_syscalls
+}
+
+func parseAllowedSyscalls(allowed_syscall string) []int {
+	syscalls := []int{}
+	if allowed_syscall == "" {
+		return syscalls
+	}
+
+	nums := strings.Split(allowed_syscall, ",")
+	for num := range nums {
+		syscall, err := strconv.Atoi(nums[num])
+		if err != nil {
+			continue
+		}
+		syscalls = append(syscalls, syscall)
+	}
+	return syscalls
+}
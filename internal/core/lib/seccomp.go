@@ -13,14 +13,26 @@ import (
 )
 
 func Seccomp(allowed_syscalls []int, allowed_not_kill_syscalls []int) error {
-	ctx, err := sg.NewFilter(sg.ActKillProcess)
+	data, err := ExportSeccompFilter(allowed_syscalls, allowed_not_kill_syscalls)
 	if err != nil {
 		return err
 	}
 
+	return LoadSeccompFilter(data)
+}
+
+// ExportSeccompFilter compiles the allow lists into a raw BPF program in
+// native byte order, ready to be handed to LoadSeccompFilter or to another
+// process that installs it through prctl(PR_SET_SECCOMP).
+func ExportSeccompFilter(allowed_syscalls []int, allowed_not_kill_syscalls []int) ([]byte, error) {
+	ctx, err := sg.NewFilter(sg.ActKillProcess)
+	if err != nil {
+		return nil, err
+	}
+
 	reader, writer, err := os.Pipe()
 	if err != nil {
-		return err
+		return nil, err
 	}
 	defer reader.Close()
 	defer writer.Close()
@@ -40,12 +52,17 @@ func Seccomp(allowed_syscalls []int, allowed_not_kill_syscalls []int) error {
 	data := make([]byte, 4096)
 	n, err := reader.Read(data)
 	if err != nil {
-		return err
+		return nil, err
 	}
+
+	return data[:n], nil
+}
+
+func LoadSeccompFilter(data []byte) error {
 	// load bpf
-	sock_filters := make([]syscall.SockFilter, n/8)
+	sock_filters := make([]syscall.SockFilter, len(data)/8)
 	bytesBuffer := bytes.NewBuffer(data)
-	err = binary.Read(bytesBuffer, binary.LittleEndian, &sock_filters)
+	err := binary.Read(bytesBuffer, binary.LittleEndian, &sock_filters)
 	if err != nil {
 		return err
 	}
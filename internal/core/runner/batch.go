@@ -0,0 +1,65 @@
+package runner
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"io"
+	"strconv"
+	"strings"
+)
+
+// BatchPipe connects the server to a sandbox process started in batch mode.
+// The code followed by every input is written to Input as frames, the
+// process answers each input with exactly one frame on Output once the item
+// finished. Closing Input ends the batch.
+//
+// A frame is the decimal payload length, a newline and the payload.
+type BatchPipe struct {
+	Input  io.WriteCloser
+	Output io.ReadCloser
+	// Kill terminates the whole process, e.g. once an item timed out
+	Kill func()
+}
+
+var ErrBatchFrameTooLarge = errors.New("batch frame exceeds the limit")
+
+func WriteBatchFrame(writer io.Writer, payload []byte) error {
+	_, err := io.WriteString(writer, strconv.Itoa(len(payload))+"\n")
+	if err != nil {
+		return err
+	}
+	_, err = writer.Write(payload)
+	return err
+}
+
+// ReadBatchFrame reads one frame, frames larger than limit are rejected
+// before their payload is read. A limit of 0 disables the check.
+func ReadBatchFrame(reader *bufio.Reader, limit int) ([]byte, error) {
+	header, err := reader.ReadString('\n')
+	if err != nil {
+		if err == io.EOF && header != "" {
+			return nil, io.ErrUnexpectedEOF
+		}
+		return nil, err
+	}
+
+	length, err := strconv.Atoi(strings.TrimSuffix(header, "\n"))
+	if err != nil || length < 0 {
+		return nil, fmt.Errorf("invalid batch frame header %q", header)
+	}
+	if limit > 0 && length > limit {
+		return nil, ErrBatchFrameTooLarge
+	}
+
+	payload := make([]byte, length)
+	_, err = io.ReadFull(reader, payload)
+	if err == io.EOF {
+		err = io.ErrUnexpectedEOF
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	return payload, nil
+}
@@ -0,0 +1,45 @@
+package runner
+
+import (
+	"bufio"
+	"bytes"
+	"io"
+	"testing"
+)
+
+func TestBatchFramesRoundTrip(t *testing.T) {
+	var buf bytes.Buffer
+	payloads := []string{"print(inputs)", "", "line\nwith newline", "中文"}
+	for _, payload := range payloads {
+		if err := WriteBatchFrame(&buf, []byte(payload)); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	reader := bufio.NewReader(&buf)
+	for _, payload := range payloads {
+		frame, err := ReadBatchFrame(reader, 0)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if string(frame) != payload {
+			t.Fatalf("expected %q, got %q", payload, frame)
+		}
+	}
+
+	if _, err := ReadBatchFrame(reader, 0); err != io.EOF {
+		t.Fatalf("expected io.EOF after the last frame, got %v", err)
+	}
+}
+
+func TestReadBatchFrameRejectsOversizedAndTruncatedFrames(t *testing.T) {
+	var buf bytes.Buffer
+	WriteBatchFrame(&buf, []byte("0123456789"))
+	if _, err := ReadBatchFrame(bufio.NewReader(&buf), 4); err != ErrBatchFrameTooLarge {
+		t.Fatalf("expected ErrBatchFrameTooLarge, got %v", err)
+	}
+
+	if _, err := ReadBatchFrame(bufio.NewReader(bytes.NewBufferString("10\nshort")), 0); err != io.ErrUnexpectedEOF {
+		t.Fatalf("expected io.ErrUnexpectedEOF, got %v", err)
+	}
+}
@@ -0,0 +1,399 @@
+package cgroup
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"log/slog"
+	"os"
+	"path"
+	"strconv"
+	"strings"
+	"sync"
+	"syscall"
+	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/types"
+)
+
+const mountPoint = "/sys/fs/cgroup"
+
+// cpuPeriod is the cpu.max period in microseconds the quota is computed for.
+const cpuPeriod = 100000
+
+type Limits struct {
+	// in bytes
+	MemoryMax int64
+	// in cpus, e.g. 0.5
+	CPUMax  float64
+	PidsMax int
+	// cpuset.cpus list, e.g. 0-3
+	Cpuset string
+}
+
+// Hierarchy holds one leaf cgroup per sandbox UID. The leaves are created and
+// limited once, a run only moves its process in and reads the counters.
+type Hierarchy struct {
+	root   string
+	leaves map[int]string
+}
+
+// Setup creates the leaves for the UIDs in [minUID, maxUID) below root, which
+// must be a cgroup v2 directory. Processes living in root are moved into a
+// server leaf first, cgroup v2 only enables controllers for children of a
+// cgroup without processes. Controllers which are not available are skipped
+// together with their limit.
+func Setup(root string, limits Limits, minUID int, maxUID int) (*Hierarchy, error) {
+	available, err := os.ReadFile(path.Join(root, "cgroup.controllers"))
+	if err != nil {
+		return nil, fmt.Errorf("%s is not a cgroup v2 directory: %w", root, err)
+	}
+
+	if err := vacate(root); err != nil {
+		return nil, fmt.Errorf("move processes out of %s: %w", root, err)
+	}
+
+	wanted := []string{"memory", "pids"}
+	if limits.CPUMax > 0 {
+		wanted = append(wanted, "cpu")
+	}
+	if limits.Cpuset != "" {
+		wanted = append(wanted, "cpuset")
+	}
+
+	enabled := map[string]bool{}
+	for _, controller := range wanted {
+		if !containsField(string(available), controller) {
+			slog.Warn("cgroup controller is unavailable, its limit is not applied", "controller", controller)
+			continue
+		}
+		if err := writeFile(path.Join(root, "cgroup.subtree_control"), "+"+controller); err != nil {
+			slog.Warn("failed to enable cgroup controller, its limit is not applied", "controller", controller, "err", err)
+			continue
+		}
+		enabled[controller] = true
+	}
+
+	settings := [][2]string{}
+	if enabled["memory"] {
+		// kill the whole run instead of a single thread
+		settings = append(settings, [2]string{"memory.oom.group", "1"})
+		if limits.MemoryMax > 0 {
+			settings = append(settings,
+				[2]string{"memory.max", strconv.FormatInt(limits.MemoryMax, 10)},
+				[2]string{"memory.swap.max", "0"},
+			)
+		}
+	}
+	if enabled["cpu"] {
+		settings = append(settings, [2]string{"cpu.max", fmt.Sprintf("%d %d", int64(limits.CPUMax*cpuPeriod), cpuPeriod)})
+	}
+	if enabled["pids"] && limits.PidsMax > 0 {
+		settings = append(settings, [2]string{"pids.max", strconv.Itoa(limits.PidsMax)})
+	}
+	if enabled["cpuset"] {
+		settings = append(settings, [2]string{"cpuset.cpus", limits.Cpuset})
+	}
+
+	h := &Hierarchy{root: root, leaves: map[int]string{}}
+	for uid := minUID; uid < maxUID; uid++ {
+		leaf := path.Join(root, "sandbox-"+strconv.Itoa(uid))
+		if err := os.Mkdir(leaf, 0755); err != nil && !errors.Is(err, os.ErrExist) {
+			return nil, err
+		}
+		// a previous server may have left processes behind
+		kill(leaf)
+
+		for _, setting := range settings {
+			err := writeFile(path.Join(leaf, setting[0]), setting[1])
+			// swap accounting is optional
+			if err != nil && !(setting[0] == "memory.swap.max" && errors.Is(err, os.ErrNotExist)) {
+				return nil, fmt.Errorf("set %s of %s: %w", setting[0], leaf, err)
+			}
+		}
+		h.leaves[uid] = leaf
+	}
+
+	return h, nil
+}
+
+// vacate moves the processes of root into root/server. The root cgroup of the
+// hierarchy, which has no cgroup.type, may keep its processes.
+func vacate(root string) error {
+	if _, err := os.Stat(path.Join(root, "cgroup.type")); err != nil {
+		return nil
+	}
+
+	server := path.Join(root, "server")
+	// processes may fork while they are moved
+	for attempt := 0; attempt < 10; attempt++ {
+		procs, err := os.ReadFile(path.Join(root, "cgroup.procs"))
+		if err != nil {
+			return err
+		}
+		pids := strings.Fields(string(procs))
+		if len(pids) == 0 {
+			return nil
+		}
+
+		if err := os.Mkdir(server, 0755); err != nil && !errors.Is(err, os.ErrExist) {
+			return err
+		}
+		for _, pid := range pids {
+			err := writeFile(path.Join(server, "cgroup.procs"), pid)
+			// the process exited in between
+			if err != nil && !errors.Is(err, os.ErrNotExist) && !errors.Is(err, syscall.ESRCH) {
+				return err
+			}
+		}
+	}
+	return errors.New("processes keep appearing")
+}
+
+// Begin starts accounting a run of uid, it returns nil for a UID without a
+// leaf or when the leaf cannot be used. All methods of Run accept nil.
+func (h *Hierarchy) Begin(uid int) *Run {
+	leaf, ok := h.leaves[uid]
+	if !ok {
+		return nil
+	}
+
+	procs, err := os.OpenFile(path.Join(leaf, "cgroup.procs"), os.O_WRONLY, 0)
+	if err != nil {
+		slog.Warn("failed to open sandbox cgroup, the run is not limited", "cgroup", leaf, "err", err)
+		return nil
+	}
+
+	r := &Run{leaf: leaf, procs: procs}
+	r.cpuUsage, _ = readKeyedValue(path.Join(leaf, "cpu.stat"), "usage_usec")
+	r.oomKills, _ = readKeyedValue(path.Join(leaf, "memory.events"), "oom_kill")
+
+	// memory.peak is reset per file descriptor since linux 6.12, older kernels
+	// only know the peak since the leaf was created which says nothing about
+	// this run
+	if peak, err := os.OpenFile(path.Join(leaf, "memory.peak"), os.O_RDWR, 0); err == nil {
+		if _, err := peak.WriteString("0"); err == nil {
+			r.peak = peak
+		} else {
+			peak.Close()
+		}
+	}
+
+	return r
+}
+
+// Run is one sandbox process in its leaf.
+type Run struct {
+	leaf  string
+	procs *os.File
+	peak  *os.File
+
+	// counters of the leaf when the run began
+	cpuUsage int64
+	oomKills int64
+}
+
+// Stats is what the processes of a run consumed while they were in the leaf.
+type Stats struct {
+	CPUTime time.Duration
+	// zero when unknown
+	MemoryPeak int64
+	OOMKilled  bool
+}
+
+// Attach moves the process into the leaf. Memory charged before the move
+// stays with the server, so it has to happen before user code runs.
+func (r *Run) Attach(pid int) error {
+	if r == nil {
+		return nil
+	}
+	_, err := r.procs.WriteString(strconv.Itoa(pid))
+	return err
+}
+
+// ProcsFile is the leaf's cgroup.procs opened for writing, a process writing
+// "0" to it moves itself into the leaf.
+func (r *Run) ProcsFile() *os.File {
+	if r == nil {
+		return nil
+	}
+	return r.procs
+}
+
+// Kill kills every process in the leaf.
+func (r *Run) Kill() {
+	if r == nil {
+		return
+	}
+	kill(r.leaf)
+}
+
+var warnNoCgroupKill sync.Once
+
+// kill kills every process in leaf. cgroup.kill needs linux 5.14, on older
+// kernels every process listed in cgroup.procs gets a SIGKILL until no new
+// process shows up, a killed process cannot fork anymore.
+func kill(leaf string) {
+	err := writeFile(path.Join(leaf, "cgroup.kill"), "1")
+	if err == nil {
+		return
+	}
+	if errors.Is(err, os.ErrNotExist) {
+		warnNoCgroupKill.Do(func() {
+			slog.Warn("cgroup.kill is unavailable, sandbox processes are killed one by one", "cgroup", leaf)
+		})
+	} else {
+		slog.Warn("failed to write cgroup.kill, sandbox processes are killed one by one", "cgroup", leaf, "err", err)
+	}
+
+	killed := map[int]bool{}
+	for attempt := 0; attempt < 100; attempt++ {
+		procs, err := os.ReadFile(path.Join(leaf, "cgroup.procs"))
+		if err != nil {
+			slog.Warn("failed to list the processes of a sandbox cgroup, they are not killed", "cgroup", leaf, "err", err)
+			return
+		}
+
+		found := false
+		for _, field := range strings.Fields(string(procs)) {
+			pid, err := strconv.Atoi(field)
+			if err != nil || killed[pid] {
+				continue
+			}
+			// the process may have exited in between
+			if err := syscall.Kill(pid, syscall.SIGKILL); err != nil && !errors.Is(err, syscall.ESRCH) {
+				slog.Warn("failed to kill a sandbox process", "cgroup", leaf, "pid", pid, "err", err)
+			}
+			killed[pid] = true
+			found = true
+		}
+		if !found {
+			return
+		}
+	}
+	slog.Warn("processes keep appearing in a sandbox cgroup, some may have survived", "cgroup", leaf)
+}
+
+// Finish kills what is left in the leaf and returns the usage of the run.
+func (r *Run) Finish() Stats {
+	if r == nil {
+		return Stats{}
+	}
+	defer r.procs.Close()
+
+	// processes which escaped the reaped one must not outlive the run
+	r.Kill()
+
+	stats := Stats{}
+	if usage, err := readKeyedValue(path.Join(r.leaf, "cpu.stat"), "usage_usec"); err == nil {
+		stats.CPUTime = time.Duration(usage-r.cpuUsage) * time.Microsecond
+	}
+	if oomKills, err := readKeyedValue(path.Join(r.leaf, "memory.events"), "oom_kill"); err == nil {
+		stats.OOMKilled = oomKills > r.oomKills
+	}
+	if r.peak != nil {
+		defer r.peak.Close()
+		buf := make([]byte, 32)
+		n, _ := r.peak.ReadAt(buf, 0)
+		stats.MemoryPeak, _ = strconv.ParseInt(strings.TrimSpace(string(buf[:n])), 10, 64)
+	}
+
+	return stats
+}
+
+var hierarchy *Hierarchy
+
+// Init sets up the leaves of the sandbox UIDs in [minUID, maxUID) from the
+// configuration. When cgroups are disabled or unavailable Begin returns nil
+// and runs are only limited by their timeout.
+func Init(configuration types.DifySandboxGlobalConfigurations, minUID int, maxUID int) {
+	if !configuration.Cgroup.Enabled {
+		return
+	}
+
+	root := configuration.Cgroup.Root
+	if root == "" {
+		own, err := ownCgroup()
+		if err != nil {
+			slog.Warn("cgroup v2 is unavailable, sandbox runs are not limited", "err", err)
+			return
+		}
+		root = own
+	}
+
+	start := time.Now()
+	h, err := Setup(root, Limits{
+		MemoryMax: configuration.Cgroup.MemoryMax,
+		CPUMax:    configuration.Cgroup.CPUMax,
+		PidsMax:   configuration.Cgroup.PidsMax,
+		Cpuset:    configuration.Cgroup.Cpuset,
+	}, minUID, maxUID)
+	if err != nil {
+		slog.Warn("cgroup v2 is unavailable, sandbox runs are not limited", "root", root, "err", err)
+		return
+	}
+
+	hierarchy = h
+	slog.Info("sandbox cgroups created", "root", root, "leaves", len(h.leaves), "duration", time.Since(start))
+}
+
+// Begin starts accounting a run of uid in its leaf, see Hierarchy.Begin.
+func Begin(uid int) *Run {
+	if hierarchy == nil {
+		return nil
+	}
+	return hierarchy.Begin(uid)
+}
+
+// ownCgroup returns the cgroup v2 directory of the server.
+func ownCgroup() (string, error) {
+	file, err := os.Open("/proc/self/cgroup")
+	if err != nil {
+		return "", err
+	}
+	defer file.Close()
+
+	scanner := bufio.NewScanner(file)
+	for scanner.Scan() {
+		if cgroup, ok := strings.CutPrefix(scanner.Text(), "0::"); ok {
+			return path.Join(mountPoint, cgroup), nil
+		}
+	}
+	return "", errors.New("no cgroup v2 entry in /proc/self/cgroup")
+}
+
+// readKeyedValue reads the value of key from a flat keyed file such as
+// cpu.stat.
+func readKeyedValue(file string, key string) (int64, error) {
+	content, err := os.ReadFile(file)
+	if err != nil {
+		return 0, err
+	}
+	for _, line := range strings.Split(string(content), "\n") {
+		if value, ok := strings.CutPrefix(line, key+" "); ok {
+			return strconv.ParseInt(strings.TrimSpace(value), 10, 64)
+		}
+	}
+	return 0, fmt.Errorf("%s has no %s", file, key)
+}
+
+func containsField(s string, field string) bool {
+	for _, f := range strings.Fields(s) {
+		if f == field {
+			return true
+		}
+	}
+	return false
+}
+
+func writeFile(file string, value string) error {
+	f, err := os.OpenFile(file, os.O_WRONLY, 0)
+	if err != nil {
+		return err
+	}
+	_, err = f.WriteString(value)
+	if closeErr := f.Close(); err == nil {
+		err = closeErr
+	}
+	return err
+}
@@ -0,0 +1,131 @@
+package cgroup
+
+import (
+	"os"
+	"os/exec"
+	"path"
+	"strconv"
+	"syscall"
+	"testing"
+	"time"
+)
+
+func writeLeafFiles(t *testing.T, leaf string, files map[string]string) {
+	t.Helper()
+	for name, content := range files {
+		if err := os.WriteFile(path.Join(leaf, name), []byte(content), 0644); err != nil {
+			t.Fatal(err)
+		}
+	}
+}
+
+func TestRunReportsUsageSinceBegin(t *testing.T) {
+	leaf := t.TempDir()
+	writeLeafFiles(t, leaf, map[string]string{
+		"cgroup.procs":  "",
+		"cgroup.kill":   "",
+		"cpu.stat":      "usage_usec 1000\nuser_usec 600\nsystem_usec 400\n",
+		"memory.events": "low 0\nhigh 0\nmax 3\noom 1\noom_kill 1\noom_group_kill 0\n",
+		"memory.peak":   "",
+	})
+	h := &Hierarchy{root: path.Dir(leaf), leaves: map[int]string{10000: leaf}}
+
+	run := h.Begin(10000)
+	if run == nil {
+		t.Fatalf("expected a run for a uid with a leaf")
+	}
+	if err := run.Attach(42); err != nil {
+		t.Fatal(err)
+	}
+
+	// the run burns 250ms of cpu and gets oom killed at 64MiB
+	writeLeafFiles(t, leaf, map[string]string{
+		"cpu.stat":      "usage_usec 251000\nuser_usec 200600\nsystem_usec 50400\n",
+		"memory.events": "low 0\nhigh 0\nmax 9\noom 2\noom_kill 2\noom_group_kill 1\n",
+		"memory.peak":   "67108864\n",
+	})
+
+	stats := run.Finish()
+	if stats.CPUTime != 250*time.Millisecond {
+		t.Fatalf("expected 250ms of cpu time, got %v", stats.CPUTime)
+	}
+	if !stats.OOMKilled {
+		t.Fatalf("expected the oom kill of the run to be reported")
+	}
+	if stats.MemoryPeak != 64<<20 {
+		t.Fatalf("expected a peak of 64MiB, got %d", stats.MemoryPeak)
+	}
+
+	procs, _ := os.ReadFile(path.Join(leaf, "cgroup.procs"))
+	if string(procs) != "42" {
+		t.Fatalf("expected the pid to be written to cgroup.procs, got %q", procs)
+	}
+	kill, _ := os.ReadFile(path.Join(leaf, "cgroup.kill"))
+	if string(kill) != "1" {
+		t.Fatalf("expected the leftovers of the run to be killed")
+	}
+}
+
+func TestRunWithoutMemoryControllerReportsCPUOnly(t *testing.T) {
+	leaf := t.TempDir()
+	writeLeafFiles(t, leaf, map[string]string{
+		"cgroup.procs": "",
+		"cpu.stat":     "usage_usec 0\n",
+	})
+	h := &Hierarchy{root: path.Dir(leaf), leaves: map[int]string{10000: leaf}}
+
+	run := h.Begin(10000)
+	writeLeafFiles(t, leaf, map[string]string{"cpu.stat": "usage_usec 3000\n"})
+
+	stats := run.Finish()
+	if stats != (Stats{CPUTime: 3 * time.Millisecond}) {
+		t.Fatalf("unexpected stats %+v", stats)
+	}
+}
+
+func TestNilRunIsANoop(t *testing.T) {
+	h := &Hierarchy{leaves: map[int]string{}}
+
+	run := h.Begin(10000)
+	if run != nil {
+		t.Fatalf("expected no run for a uid without a leaf")
+	}
+	if err := run.Attach(42); err != nil {
+		t.Fatal(err)
+	}
+	if run.ProcsFile() != nil {
+		t.Fatalf("expected no cgroup.procs file")
+	}
+	run.Kill()
+	if stats := run.Finish(); stats != (Stats{}) {
+		t.Fatalf("expected empty stats, got %+v", stats)
+	}
+}
+
+func TestSetupRejectsNonCgroup2Directory(t *testing.T) {
+	if _, err := Setup(t.TempDir(), Limits{}, 10000, 10001); err == nil {
+		t.Fatalf("expected an error for a directory without cgroup.controllers")
+	}
+}
+
+func TestKillWithoutCgroupKillSignalsEveryProcess(t *testing.T) {
+	cmd := exec.Command("/bin/sleep", "10")
+	if err := cmd.Start(); err != nil {
+		t.Fatal(err)
+	}
+
+	// kernels before 5.14 have no cgroup.kill
+	leaf := t.TempDir()
+	writeLeafFiles(t, leaf, map[string]string{
+		"cgroup.procs": strconv.Itoa(cmd.Process.Pid) + "\n",
+	})
+
+	run := &Run{leaf: leaf}
+	run.Kill()
+
+	err := cmd.Wait()
+	status, ok := cmd.ProcessState.Sys().(syscall.WaitStatus)
+	if err == nil || !ok || status.Signal() != syscall.SIGKILL {
+		t.Fatalf("expected the process to be killed, got %v", err)
+	}
+}
@@ -0,0 +1,144 @@
+package runner
+
+import (
+	"bufio"
+	"container/list"
+	"crypto/sha256"
+	"io"
+	"sync"
+
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
+)
+
+// CodeCache keeps compiled artifacts of snippets keyed by the hash of their
+// source, e.g. marshalled python code objects or V8 code cache data. The
+// least recently used artifacts are evicted once their total size exceeds the
+// limit.
+//
+// A run sends the cached artifact next to the source on fd 3, see WriteCode.
+// The sandbox confirms a used artifact with an empty frame on the ready pipe.
+// Without a usable artifact it compiles the source and reports the new
+// artifact there instead. Either happens before it closes that pipe and runs
+// the code, so user code never gets to write an artifact.
+type CodeCache struct {
+	language string
+	maxBytes int
+
+	lock    sync.Mutex
+	size    int
+	lru     *list.List
+	entries map[CodeHash]*list.Element
+}
+
+type CodeHash [sha256.Size]byte
+
+type codeCacheEntry struct {
+	hash     CodeHash
+	artifact []byte
+}
+
+func NewCodeCache(language string, maxBytes int) *CodeCache {
+	return &CodeCache{
+		language: language,
+		maxBytes: maxBytes,
+		lru:      list.New(),
+		entries:  map[CodeHash]*list.Element{},
+	}
+}
+
+// Lookup returns the cached artifact of code to send on fd 3 and the
+// SetAfterReady hook of the run. A preload runs before the code is compiled
+// and may replace compile or marshal, runs with one neither use nor fill the
+// cache and get neither.
+func (c *CodeCache) Lookup(code string, preload string) ([]byte, func(io.Reader)) {
+	if preload != "" {
+		return nil, nil
+	}
+	hash, artifact := c.Get(code)
+	return artifact, c.ReadArtifact(hash)
+}
+
+// Get returns the hash of code and its cached artifact, nil on a miss.
+func (c *CodeCache) Get(code string) (CodeHash, []byte) {
+	hash := CodeHash(sha256.Sum256([]byte(code)))
+
+	c.lock.Lock()
+	element, ok := c.entries[hash]
+	if ok {
+		c.lru.MoveToFront(element)
+	}
+	c.lock.Unlock()
+
+	if !ok {
+		return hash, nil
+	}
+	return hash, element.Value.(*codeCacheEntry).artifact
+}
+
+// Put stores the artifact of the code with the given hash, artifacts larger
+// than the whole cache are dropped.
+func (c *CodeCache) Put(hash CodeHash, artifact []byte) {
+	if len(artifact) == 0 || len(artifact) > c.maxBytes {
+		return
+	}
+
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if element, ok := c.entries[hash]; ok {
+		entry := element.Value.(*codeCacheEntry)
+		c.size += len(artifact) - len(entry.artifact)
+		entry.artifact = artifact
+		c.lru.MoveToFront(element)
+	} else {
+		c.entries[hash] = c.lru.PushFront(&codeCacheEntry{hash: hash, artifact: artifact})
+		c.size += len(artifact)
+	}
+
+	for c.size > c.maxBytes {
+		oldest := c.lru.Back()
+		entry := oldest.Value.(*codeCacheEntry)
+		c.lru.Remove(oldest)
+		delete(c.entries, entry.hash)
+		c.size -= len(entry.artifact)
+	}
+}
+
+// Len is the number of cached artifacts.
+func (c *CodeCache) Len() int {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+	return c.lru.Len()
+}
+
+// ReadArtifact returns an OutputCaptureRunner.SetAfterReady hook which stores
+// the artifact the sandbox reports after it became ready. Only a sandbox
+// which confirmed the cached artifact with an empty frame counts as a hit.
+func (c *CodeCache) ReadArtifact(hash CodeHash) func(io.Reader) {
+	return func(reader io.Reader) {
+		artifact, err := ReadBatchFrame(bufio.NewReader(reader), c.maxBytes)
+		if err == nil && len(artifact) == 0 {
+			metrics.CodeCacheHits.Inc(c.language)
+			return
+		}
+
+		// compiled in the sandbox, nothing is reported when that failed
+		metrics.CodeCacheMisses.Inc(c.language)
+		if err == nil {
+			c.Put(hash, artifact)
+		}
+	}
+}
+
+// WriteCode writes the fd 3 payload of a single run, the cached artifact as
+// one frame, empty on a miss, followed by the source.
+func WriteCode(w io.Writer, artifact []byte, code string) error {
+	writer := bufio.NewWriter(w)
+	if err := WriteBatchFrame(writer, artifact); err != nil {
+		return err
+	}
+	if _, err := writer.WriteString(code); err != nil {
+		return err
+	}
+	return writer.Flush()
+}
@@ -0,0 +1,140 @@
+package runner
+
+import (
+	"bytes"
+	"strings"
+	"testing"
+
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
+)
+
+func TestCodeCacheReturnsStoredArtifact(t *testing.T) {
+	cache := NewCodeCache("code_cache_test", 1024)
+
+	hash, artifact := cache.Get("print(1)")
+	if artifact != nil {
+		t.Fatalf("expected a miss on an empty cache")
+	}
+	cache.Put(hash, []byte("compiled"))
+
+	again, artifact := cache.Get("print(1)")
+	if again != hash || string(artifact) != "compiled" {
+		t.Fatalf("expected the stored artifact, got %q", artifact)
+	}
+	if _, artifact := cache.Get("print(2)"); artifact != nil {
+		t.Fatalf("expected a miss for other code, got %q", artifact)
+	}
+}
+
+func TestCodeCacheEvictsLeastRecentlyUsed(t *testing.T) {
+	cache := NewCodeCache("code_cache_test", 10)
+
+	a, _ := cache.Get("a")
+	b, _ := cache.Get("b")
+	c, _ := cache.Get("c")
+	cache.Put(a, []byte("aaaa"))
+	cache.Put(b, []byte("bbbb"))
+	// a is used again, b is the oldest now
+	cache.Get("a")
+	cache.Put(c, []byte("cccc"))
+
+	if _, artifact := cache.Get("b"); artifact != nil {
+		t.Fatalf("expected b to be evicted")
+	}
+	for _, code := range []string{"a", "c"} {
+		if _, artifact := cache.Get(code); artifact == nil {
+			t.Fatalf("expected %s to stay cached", code)
+		}
+	}
+
+	// larger than the whole cache
+	cache.Put(a, bytes.Repeat([]byte("x"), 11))
+	if _, artifact := cache.Get("a"); string(artifact) != "aaaa" {
+		t.Fatalf("expected an oversized artifact to be dropped, got %q", artifact)
+	}
+}
+
+func TestCodeCacheReadsArtifactReportedBySandbox(t *testing.T) {
+	cache := NewCodeCache("code_cache_test", 1024)
+	hash, _ := cache.Get("x = 1")
+
+	var reported bytes.Buffer
+	WriteBatchFrame(&reported, []byte("marshalled"))
+	cache.ReadArtifact(hash)(&reported)
+
+	if _, artifact := cache.Get("x = 1"); string(artifact) != "marshalled" {
+		t.Fatalf("expected the reported artifact to be cached, got %q", artifact)
+	}
+
+	// a sandbox which used the cached artifact confirms it with an empty frame
+	cache.ReadArtifact(hash)(strings.NewReader("0\n"))
+	if _, artifact := cache.Get("x = 1"); string(artifact) != "marshalled" {
+		t.Fatalf("expected the confirmation to keep the artifact, got %q", artifact)
+	}
+}
+
+func TestCodeCacheCountsHitsConfirmedBySandbox(t *testing.T) {
+	cache := NewCodeCache("code_cache_hits_test", 1024)
+	hash, _ := cache.Get("x = 1")
+	cache.Put(hash, []byte("marshalled"))
+
+	// rejected and recompiled, confirmed, and exited before reporting anything
+	var reported bytes.Buffer
+	WriteBatchFrame(&reported, []byte("recompiled"))
+	cache.ReadArtifact(hash)(&reported)
+	cache.ReadArtifact(hash)(strings.NewReader("0\n"))
+	cache.ReadArtifact(hash)(strings.NewReader(""))
+
+	var text bytes.Buffer
+	metrics.DefaultRegistry.WriteText(&text)
+	for _, series := range []string{
+		`dify_sandbox_code_cache_hits_total{language="code_cache_hits_test"} 1`,
+		`dify_sandbox_code_cache_misses_total{language="code_cache_hits_test"} 2`,
+	} {
+		if !strings.Contains(text.String(), series) {
+			t.Fatalf("expected %s in metrics output", series)
+		}
+	}
+}
+
+func TestCodeCacheLookupSkipsRunsWithPreload(t *testing.T) {
+	cache := NewCodeCache("code_cache_test", 1024)
+	hash, _ := cache.Get("print(1)")
+	cache.Put(hash, []byte("compiled"))
+
+	artifact, afterReady := cache.Lookup("print(1)", "import os")
+	if artifact != nil || afterReady != nil {
+		t.Fatalf("expected a preload run to neither get an artifact nor report one")
+	}
+
+	artifact, afterReady = cache.Lookup("print(2)", "")
+	if artifact != nil || afterReady == nil {
+		t.Fatalf("expected a miss with a hook for a run without preload")
+	}
+	var reported bytes.Buffer
+	WriteBatchFrame(&reported, []byte("compiled"))
+	afterReady(&reported)
+	if cache.Len() != 2 {
+		t.Fatalf("expected the reported artifact to be cached, got %d artifacts", cache.Len())
+	}
+
+	if artifact, _ := cache.Lookup("print(1)", ""); string(artifact) != "compiled" {
+		t.Fatalf("expected the cached artifact without preload, got %q", artifact)
+	}
+}
+
+func TestWriteCodePrependsArtifactFrame(t *testing.T) {
+	var payload bytes.Buffer
+	if err := WriteCode(&payload, []byte("abc"), "print(1)\n"); err != nil {
+		t.Fatal(err)
+	}
+	if payload.String() != "3\nabcprint(1)\n" {
+		t.Fatalf("unexpected fd 3 payload %q", payload.String())
+	}
+
+	payload.Reset()
+	WriteCode(&payload, nil, "print(1)\n")
+	if payload.String() != "0\nprint(1)\n" {
+		t.Fatalf("unexpected fd 3 payload without artifact %q", payload.String())
+	}
+}
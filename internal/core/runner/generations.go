@@ -0,0 +1,642 @@
+package runner
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"path"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"syscall"
+	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
+)
+
+// SandboxGenerations keeps a sandbox root which is rebuilt while runs are
+// using it. Every sync mirrors the required paths into a fresh generation
+// directory, a hardlink farm like SandboxRootfs, and makes it the current one
+// once it is complete. Runs hold the generation they started in, a replaced
+// generation is removed once its last run released it.
+//
+// A sync scans the paths into a manifest of device, inode, size, mtime and
+// mode per file. Nothing is written when the manifest equals the one of the
+// current generation, unchanged files of a new generation are linked from the
+// current one, so files which had to be copied are not copied again. The
+// manifest is stored next to the generation, a restarted server adopts the
+// newest generation it owns when the paths did not change in between.
+type SandboxGenerations struct {
+	dir      string
+	language string
+
+	// serializes syncs, runs only take lock
+	syncLock sync.Mutex
+	nextID   int
+
+	// loaded by Resume but outdated, the next sync links from it, guarded by
+	// syncLock
+	adopted *Generation
+
+	lock    sync.Mutex
+	current *Generation
+	// generations on disk, including the current one
+	live int
+}
+
+// Generation is one complete sandbox root, it is never modified once it
+// became current.
+type Generation struct {
+	id       int
+	root     string
+	manifest manifest
+	owner    *SandboxGenerations
+
+	// guarded by owner.lock
+	refs    int
+	retired bool
+}
+
+// SyncStats describes what a sync did.
+type SyncStats struct {
+	// the current generation after the sync
+	Generation int
+	// a new generation became current
+	Switched bool
+	// entries of the manifest, directories and symlinks included
+	Files int
+	// changed files hardlinked from their source
+	Linked int
+	// changed files copied since they live on another filesystem
+	Copied int
+	// unchanged files linked from the previous generation
+	Reused   int
+	Duration time.Duration
+}
+
+// manifestEntry is one path of a generation. Source is the path the entry
+// was read from, it differs from the key below a followed directory symlink.
+type manifestEntry struct {
+	Source  string `json:"s"`
+	Dir     bool   `json:"d,omitempty"`
+	Symlink string `json:"l,omitempty"`
+	Dev     uint64 `json:"v,omitempty"`
+	Ino     uint64 `json:"i,omitempty"`
+	Size    int64  `json:"n,omitempty"`
+	Mtime   int64  `json:"t,omitempty"`
+	Mode    uint32 `json:"m,omitempty"`
+}
+
+// manifest maps the paths of a generation, relative to its root, to their
+// entries.
+type manifest map[string]manifestEntry
+
+func (e manifestEntry) unchanged(other manifestEntry) bool {
+	return e.Dir == other.Dir &&
+		e.Symlink == other.Symlink &&
+		e.Dev == other.Dev &&
+		e.Ino == other.Ino &&
+		e.Size == other.Size &&
+		e.Mtime == other.Mtime &&
+		e.Mode == other.Mode
+}
+
+func (m manifest) equal(other manifest) bool {
+	if len(m) != len(other) {
+		return false
+	}
+	for key, entry := range m {
+		if previous, ok := other[key]; !ok || !entry.unchanged(previous) {
+			return false
+		}
+	}
+	return true
+}
+
+// syncWorkers is the number of files linked in parallel, the work is mostly
+// waiting for the filesystem.
+var syncWorkers = 2 * runtime.NumCPU()
+
+// NewSandboxGenerations keeps the generations of language below dir.
+func NewSandboxGenerations(dir string, language string) *SandboxGenerations {
+	return &SandboxGenerations{dir: dir, language: language}
+}
+
+// Acquire returns the current generation and keeps it until Release, nil
+// before the first successful sync. All methods of Generation accept nil.
+func (g *SandboxGenerations) Acquire() *Generation {
+	g.lock.Lock()
+	defer g.lock.Unlock()
+
+	if g.current != nil {
+		g.current.refs++
+	}
+	return g.current
+}
+
+// Ready reports whether a generation is current. Once it is, Acquire never
+// returns nil again.
+func (g *SandboxGenerations) Ready() bool {
+	g.lock.Lock()
+	defer g.lock.Unlock()
+	return g.current != nil
+}
+
+// Len is the number of generations on disk.
+func (g *SandboxGenerations) Len() int {
+	g.lock.Lock()
+	defer g.lock.Unlock()
+	return g.live
+}
+
+func (gen *Generation) Root() string {
+	if gen == nil {
+		return ""
+	}
+	return gen.root
+}
+
+// Release ends the use of the generation, the last run of a replaced
+// generation removes it.
+func (gen *Generation) Release() {
+	if gen == nil {
+		return
+	}
+
+	g := gen.owner
+	g.lock.Lock()
+	gen.refs--
+	remove := gen.retired && gen.refs == 0
+	g.lock.Unlock()
+
+	if remove {
+		go g.remove(gen)
+	}
+}
+
+// Resume makes the generation a previous server left behind current if it
+// still mirrors paths, without building anything. It reports whether runs
+// can start, an outdated generation is kept for the next Sync to link from.
+func (g *SandboxGenerations) Resume(paths []string) (bool, error) {
+	g.syncLock.Lock()
+	defer g.syncLock.Unlock()
+
+	if g.Ready() {
+		return true, nil
+	}
+
+	adopted := g.adopt()
+	if adopted == nil {
+		return false, nil
+	}
+
+	scanned, err := scanPaths(paths)
+	if err != nil {
+		g.adopted = adopted
+		return false, err
+	}
+	if !adopted.manifest.equal(scanned) {
+		g.adopted = adopted
+		return false, nil
+	}
+
+	g.publish(adopted)
+	return true, nil
+}
+
+// Sync makes a generation mirroring paths current, see SandboxGenerations.
+// Paths which do not exist are skipped. On error the current generation
+// stays in place.
+func (g *SandboxGenerations) Sync(paths []string) (SyncStats, error) {
+	g.syncLock.Lock()
+	defer g.syncLock.Unlock()
+
+	start := time.Now()
+	scanned, err := scanPaths(paths)
+	if err != nil {
+		return SyncStats{}, err
+	}
+
+	if err := os.MkdirAll(g.dir, 0755); err != nil {
+		return SyncStats{}, err
+	}
+
+	g.lock.Lock()
+	current := g.current
+	g.lock.Unlock()
+
+	stats := SyncStats{Files: len(scanned)}
+	// left behind by a previous server, it only becomes current when it
+	// mirrors the paths as they are now
+	adopted := false
+	if current == nil {
+		current = g.adopt()
+		adopted = current != nil
+	}
+
+	if current != nil && current.manifest.equal(scanned) {
+		if _, err := os.Stat(current.root); err == nil {
+			if adopted {
+				stats.Switched = g.publish(current)
+			}
+			stats.Generation = current.id
+			stats.Duration = time.Since(start)
+			g.observe(stats)
+			return stats, nil
+		}
+	}
+
+	g.nextID++
+	id := g.nextID
+
+	gen := &Generation{
+		id:       id,
+		root:     path.Join(g.dir, strconv.Itoa(id)),
+		manifest: scanned,
+		owner:    g,
+	}
+	if err := g.build(gen, current, &stats); err != nil {
+		os.RemoveAll(gen.root)
+		if adopted {
+			// outdated, but better than refusing every run
+			g.publish(current)
+		}
+		return SyncStats{}, err
+	}
+	g.lock.Lock()
+	g.live++
+	g.lock.Unlock()
+
+	stats.Generation = id
+	stats.Switched = g.publish(gen)
+	if adopted {
+		// it never became current, nothing holds it
+		go g.remove(current)
+	}
+	stats.Duration = time.Since(start)
+	g.observe(stats)
+	return stats, nil
+}
+
+// publish makes gen current and retires the previous generation. It reports
+// whether the current generation changed.
+func (g *SandboxGenerations) publish(gen *Generation) bool {
+	g.lock.Lock()
+	previous := g.current
+	if previous == gen {
+		g.lock.Unlock()
+		return false
+	}
+	g.current = gen
+
+	remove := false
+	if previous != nil {
+		previous.retired = true
+		remove = previous.refs == 0
+	}
+	g.lock.Unlock()
+
+	if remove {
+		go g.remove(previous)
+	}
+	return true
+}
+
+func (g *SandboxGenerations) remove(gen *Generation) {
+	// without its manifest a half removed generation is never adopted
+	os.Remove(gen.root + ".manifest")
+	os.RemoveAll(gen.root)
+
+	g.lock.Lock()
+	g.live--
+	g.lock.Unlock()
+}
+
+func (g *SandboxGenerations) observe(stats SyncStats) {
+	metrics.EnvSyncSeconds.Observe(stats.Duration.Seconds(), g.language)
+	metrics.EnvSyncFiles.Add(float64(stats.Linked), g.language, "linked")
+	metrics.EnvSyncFiles.Add(float64(stats.Copied), g.language, "copied")
+	metrics.EnvSyncFiles.Add(float64(stats.Reused), g.language, "reused")
+}
+
+// adopt loads the newest complete generation on disk and removes all others,
+// it returns nil when there is none. Generations the server could not have
+// written itself are never read.
+func (g *SandboxGenerations) adopt() *Generation {
+	if adopted := g.adopted; adopted != nil {
+		g.adopted = nil
+		return adopted
+	}
+	if !ownedPath(g.dir, true) {
+		return nil
+	}
+	entries, err := os.ReadDir(g.dir)
+	if err != nil {
+		return nil
+	}
+
+	ids := []int{}
+	seen := map[int]bool{}
+	for _, entry := range entries {
+		id, err := strconv.Atoi(strings.TrimSuffix(entry.Name(), ".manifest"))
+		if err != nil || seen[id] {
+			continue
+		}
+		seen[id] = true
+		ids = append(ids, id)
+		g.nextID = max(g.nextID, id)
+	}
+	sort.Sort(sort.Reverse(sort.IntSlice(ids)))
+
+	var adopted *Generation
+	for _, id := range ids {
+		root := path.Join(g.dir, strconv.Itoa(id))
+		if adopted == nil {
+			if adopted = loadGeneration(id, root); adopted != nil {
+				adopted.owner = g
+				continue
+			}
+		}
+		os.Remove(root + ".manifest")
+		os.RemoveAll(root)
+	}
+
+	if adopted != nil {
+		g.lock.Lock()
+		g.live++
+		g.lock.Unlock()
+	}
+	return adopted
+}
+
+// loadGeneration reads the generation id in root. The root and its manifest
+// are checked before the manifest is trusted, every key of the manifest has
+// to be a clean absolute path as scanPaths produces them.
+func loadGeneration(id int, root string) *Generation {
+	if !ownedPath(root, true) || !ownedPath(root+".manifest", false) {
+		return nil
+	}
+
+	data, err := os.ReadFile(root + ".manifest")
+	if err != nil {
+		return nil
+	}
+	m := manifest{}
+	if err := json.Unmarshal(data, &m); err != nil {
+		return nil
+	}
+	for key := range m {
+		if !path.IsAbs(key) || path.Clean(key) != key {
+			return nil
+		}
+	}
+	return &Generation{id: id, root: root, manifest: m}
+}
+
+// ownedPath reports whether file is a directory or regular file, as dir
+// says, owned by the server and writable by nobody else.
+func ownedPath(file string, dir bool) bool {
+	info, err := os.Lstat(file)
+	if err != nil || info.IsDir() != dir || (!dir && !info.Mode().IsRegular()) {
+		return false
+	}
+	stat, ok := info.Sys().(*syscall.Stat_t)
+	return ok && int(stat.Uid) == os.Geteuid() && info.Mode().Perm()&0022 == 0
+}
+
+// build creates the root of gen from its manifest. Unchanged entries of
+// previous are linked from there.
+func (g *SandboxGenerations) build(gen *Generation, previous *Generation, stats *SyncStats) error {
+	if err := os.Mkdir(gen.root, 0755); err != nil {
+		return err
+	}
+
+	// parents before children
+	keys := make([]string, 0, len(gen.manifest))
+	for key := range gen.manifest {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+
+	files := make([]string, 0, len(keys))
+	for _, key := range keys {
+		if !gen.manifest[key].Dir {
+			files = append(files, key)
+			continue
+		}
+		if err := os.MkdirAll(path.Join(gen.root, key), 0755); err != nil {
+			return err
+		}
+	}
+
+	var lock sync.Mutex
+	var firstErr error
+	work := make(chan string)
+	wg := sync.WaitGroup{}
+	for i := 0; i < syncWorkers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for key := range work {
+				action, err := linkEntry(gen, previous, key)
+
+				lock.Lock()
+				switch {
+				case err != nil && firstErr == nil:
+					firstErr = err
+				case action == "linked":
+					stats.Linked++
+				case action == "copied":
+					stats.Copied++
+				case action == "reused":
+					stats.Reused++
+				}
+				lock.Unlock()
+			}
+		}()
+	}
+	for _, key := range files {
+		work <- key
+	}
+	close(work)
+	wg.Wait()
+
+	if firstErr != nil {
+		return firstErr
+	}
+
+	data, err := json.Marshal(gen.manifest)
+	if err != nil {
+		return err
+	}
+	// the manifest marks the generation as complete
+	return os.WriteFile(gen.root+".manifest", data, 0644)
+}
+
+// linkEntry creates the file or symlink key of gen and reports how.
+func linkEntry(gen *Generation, previous *Generation, key string) (string, error) {
+	entry := gen.manifest[key]
+	dst := path.Join(gen.root, key)
+
+	if entry.Symlink != "" {
+		return "symlinked", os.Symlink(entry.Symlink, dst)
+	}
+
+	if previous != nil {
+		if old, ok := previous.manifest[key]; ok && old.unchanged(entry) {
+			if err := os.Link(path.Join(previous.root, key), dst); err == nil {
+				return "reused", nil
+			}
+		}
+	}
+
+	if err := os.Link(entry.Source, dst); err == nil {
+		return "linked", nil
+	}
+	if err := copyFile(entry.Source, dst); err != nil {
+		return "", fmt.Errorf("copy %s: %w", entry.Source, err)
+	}
+	return "copied", os.Chmod(dst, 0444)
+}
+
+// scanPaths builds the manifest of paths in parallel. Directory symlinks are
+// followed, other symlinks are kept as symlinks. Devices, sockets and pipes
+// are never required inside the sandbox.
+func scanPaths(paths []string) (manifest, error) {
+	s := &scanner{
+		entries: manifest{},
+		sem:     make(chan struct{}, syncWorkers),
+	}
+
+	for _, file_path := range paths {
+		file_path = filepath.Clean(file_path)
+		if _, err := os.Lstat(file_path); err != nil {
+			continue
+		}
+		// the parents of a path are plain directories in the sandbox
+		for dir := path.Dir(file_path); dir != "/" && dir != "."; dir = path.Dir(dir) {
+			s.add(dir, manifestEntry{Source: dir, Dir: true})
+		}
+		s.wg.Add(1)
+		go s.scan(file_path, file_path, nil)
+	}
+	s.wg.Wait()
+
+	if s.err != nil {
+		return nil, s.err
+	}
+	return s.entries, nil
+}
+
+type scanner struct {
+	wg  sync.WaitGroup
+	sem chan struct{}
+
+	lock    sync.Mutex
+	entries manifest
+	err     error
+}
+
+type fileID struct {
+	dev uint64
+	ino uint64
+}
+
+func (s *scanner) add(key string, entry manifestEntry) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+	if _, ok := s.entries[key]; !ok {
+		s.entries[key] = entry
+	}
+}
+
+func (s *scanner) fail(err error) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+	if s.err == nil {
+		s.err = err
+	}
+}
+
+// scan adds the entry key read from source, ancestors are the directories
+// above it and guard against symlink loops.
+func (s *scanner) scan(key string, source string, ancestors []fileID) {
+	defer s.wg.Done()
+
+	info, err := os.Lstat(source)
+	if err != nil {
+		// removed while scanning
+		if !errors.Is(err, os.ErrNotExist) {
+			s.fail(err)
+		}
+		return
+	}
+
+	if info.Mode()&os.ModeSymlink != 0 {
+		target, err := os.Readlink(source)
+		if err != nil {
+			s.fail(err)
+			return
+		}
+		resolved, err := os.Stat(source)
+		if err != nil || !resolved.IsDir() {
+			s.add(key, manifestEntry{Source: source, Symlink: target})
+			return
+		}
+		info = resolved
+	}
+
+	stat, _ := info.Sys().(*syscall.Stat_t)
+	entry := manifestEntry{
+		Source: source,
+		Size:   info.Size(),
+		Mtime:  info.ModTime().UnixNano(),
+		Mode:   uint32(info.Mode()),
+	}
+	if stat != nil {
+		entry.Dev = uint64(stat.Dev)
+		entry.Ino = stat.Ino
+	}
+
+	switch {
+	case info.IsDir():
+		id := fileID{entry.Dev, entry.Ino}
+		for _, ancestor := range ancestors {
+			if ancestor == id {
+				return
+			}
+		}
+		s.add(key, manifestEntry{Source: source, Dir: true})
+
+		children, err := os.ReadDir(source)
+		if err != nil {
+			s.fail(err)
+			return
+		}
+		ancestors = append(ancestors[:len(ancestors):len(ancestors)], id)
+		for _, child := range children {
+			childKey := path.Join(key, child.Name())
+			childSource := path.Join(source, child.Name())
+
+			s.wg.Add(1)
+			if child.IsDir() {
+				select {
+				case s.sem <- struct{}{}:
+					go func() {
+						defer func() { <-s.sem }()
+						s.scan(childKey, childSource, ancestors)
+					}()
+					continue
+				default:
+				}
+			}
+			s.scan(childKey, childSource, ancestors)
+		}
+	case info.Mode().IsRegular():
+		s.add(key, entry)
+	}
+}
@@ -0,0 +1,309 @@
+package runner
+
+import (
+	"os"
+	"path"
+	"strconv"
+	"syscall"
+	"testing"
+	"time"
+)
+
+func inode(t *testing.T, file string) uint64 {
+	t.Helper()
+	info, err := os.Stat(file)
+	if err != nil {
+		t.Fatal(err)
+	}
+	return info.Sys().(*syscall.Stat_t).Ino
+}
+
+func waitGenerations(t *testing.T, g *SandboxGenerations, live int) {
+	t.Helper()
+	for i := 0; i < 1000; i++ {
+		if g.Len() == live {
+			return
+		}
+		time.Sleep(time.Millisecond)
+	}
+	t.Fatalf("expected %d generations on disk, got %d", live, g.Len())
+}
+
+func TestSandboxGenerationsMirrorsPaths(t *testing.T) {
+	src := t.TempDir()
+	real := path.Join(src, "real")
+	if err := os.MkdirAll(path.Join(real, "pkg"), 0755); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(real, "pkg", "module.py"), []byte("x = 1"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Symlink("module.py", path.Join(real, "pkg", "alias.py")); err != nil {
+		t.Fatal(err)
+	}
+	// a directory symlink and a loop back to its parent
+	if err := os.Symlink(real, path.Join(src, "lib")); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Symlink("..", path.Join(real, "pkg", "loop")); err != nil {
+		t.Fatal(err)
+	}
+
+	g := NewSandboxGenerations(path.Join(t.TempDir(), "generations"), "generations_test")
+	stats, err := g.Sync([]string{path.Join(src, "lib"), path.Join(src, "missing")})
+	if err != nil {
+		t.Fatalf("sync: %v", err)
+	}
+	if !stats.Switched || stats.Linked != 1 {
+		t.Fatalf("expected a new generation with one linked file, got %+v", stats)
+	}
+
+	generation := g.Acquire()
+	defer generation.Release()
+	root := generation.Root()
+
+	// the directory symlink is followed like find -L does
+	linked := path.Join(root, src, "lib", "pkg", "module.py")
+	if inode(t, linked) != inode(t, path.Join(real, "pkg", "module.py")) {
+		t.Fatal("expected the file to be hardlinked")
+	}
+	if info, err := os.Lstat(path.Join(root, src, "lib")); err != nil || !info.IsDir() {
+		t.Fatalf("expected the directory symlink to become a directory, got %v, %v", info, err)
+	}
+	if target, err := os.Readlink(path.Join(root, src, "lib", "pkg", "alias.py")); err != nil || target != "module.py" {
+		t.Fatalf("expected the file symlink to be preserved, got %q, %v", target, err)
+	}
+	if _, err := os.Lstat(path.Join(root, src, "missing")); err == nil {
+		t.Fatal("expected the missing path to be skipped")
+	}
+}
+
+func TestSandboxGenerationsSyncsOnlyChanges(t *testing.T) {
+	src := t.TempDir()
+	for _, name := range []string{"a.py", "b.py"} {
+		if err := os.WriteFile(path.Join(src, name), []byte(name), 0644); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	g := NewSandboxGenerations(path.Join(t.TempDir(), "generations"), "generations_test")
+	first, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	unchanged, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if unchanged.Switched || unchanged.Generation != first.Generation || unchanged.Linked != 0 {
+		t.Fatalf("expected an unchanged tree to keep its generation, got %+v", unchanged)
+	}
+
+	// pip replaces files instead of writing them in place
+	if err := os.Remove(path.Join(src, "b.py")); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "b.py"), []byte("b2"), 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	changed, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if !changed.Switched || changed.Generation == first.Generation {
+		t.Fatalf("expected a new generation, got %+v", changed)
+	}
+	if changed.Linked != 1 || changed.Reused != 1 {
+		t.Fatalf("expected one linked and one reused file, got %+v", changed)
+	}
+
+	data, err := os.ReadFile(path.Join(g.Acquire().Root(), src, "b.py"))
+	if err != nil || string(data) != "b2" {
+		t.Fatalf("expected the changed file in the new generation, got %q, %v", data, err)
+	}
+}
+
+func TestSandboxGenerationsKeepsReplacedGenerationUntilReleased(t *testing.T) {
+	src := t.TempDir()
+	if err := os.WriteFile(path.Join(src, "a.py"), []byte("a"), 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	g := NewSandboxGenerations(path.Join(t.TempDir(), "generations"), "generations_test")
+	if _, err := g.Sync([]string{src}); err != nil {
+		t.Fatal(err)
+	}
+
+	running := g.Acquire()
+	if err := os.WriteFile(path.Join(src, "b.py"), []byte("b"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := g.Sync([]string{src}); err != nil {
+		t.Fatal(err)
+	}
+
+	if g.Acquire().Root() == running.Root() {
+		t.Fatal("expected new runs to use the new generation")
+	}
+	if _, err := os.Stat(path.Join(running.Root(), src, "a.py")); err != nil {
+		t.Fatalf("expected the generation of a running run to stay: %v", err)
+	}
+	if _, err := os.Stat(path.Join(running.Root(), src, "b.py")); err == nil {
+		t.Fatal("expected the generation of a running run to stay unchanged")
+	}
+
+	running.Release()
+	waitGenerations(t, g, 1)
+	if _, err := os.Stat(running.Root()); err == nil {
+		t.Fatal("expected the replaced generation to be removed once released")
+	}
+}
+
+func TestSandboxGenerationsAdoptsGenerationAfterRestart(t *testing.T) {
+	src := t.TempDir()
+	if err := os.WriteFile(path.Join(src, "a.py"), []byte("a"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	dir := path.Join(t.TempDir(), "generations")
+
+	first, err := NewSandboxGenerations(dir, "generations_test").Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	// an interrupted build has no manifest
+	if err := os.MkdirAll(path.Join(dir, "7"), 0755); err != nil {
+		t.Fatal(err)
+	}
+
+	g := NewSandboxGenerations(dir, "generations_test")
+	stats, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if stats.Generation != first.Generation || stats.Linked != 0 {
+		t.Fatalf("expected the generation on disk to be adopted, got %+v", stats)
+	}
+	if _, err := os.Stat(path.Join(dir, "7")); err == nil {
+		t.Fatal("expected the interrupted build to be removed")
+	}
+	if g.Len() != 1 {
+		t.Fatalf("expected one generation, got %d", g.Len())
+	}
+}
+
+func TestSandboxGenerationsDoesNotAdoptWritableManifest(t *testing.T) {
+	src := t.TempDir()
+	if err := os.WriteFile(path.Join(src, "a.py"), []byte("a"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	dir := path.Join(t.TempDir(), "generations")
+
+	first, err := NewSandboxGenerations(dir, "generations_test").Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	manifestPath := path.Join(dir, strconv.Itoa(first.Generation)+".manifest")
+	if err := os.Chmod(manifestPath, 0666); err != nil {
+		t.Fatal(err)
+	}
+
+	g := NewSandboxGenerations(dir, "generations_test")
+	stats, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if stats.Generation == first.Generation || stats.Linked != 1 {
+		t.Fatalf("expected a manifest others may write to be rebuilt, got %+v", stats)
+	}
+	if _, err := os.Stat(manifestPath); err == nil {
+		t.Fatal("expected the untrusted generation to be removed")
+	}
+}
+
+func TestSandboxGenerationsAdoptsChangedGenerationOnlyForReuse(t *testing.T) {
+	src := t.TempDir()
+	for _, name := range []string{"a.py", "b.py"} {
+		if err := os.WriteFile(path.Join(src, name), []byte(name), 0644); err != nil {
+			t.Fatal(err)
+		}
+	}
+	dir := path.Join(t.TempDir(), "generations")
+
+	first, err := NewSandboxGenerations(dir, "generations_test").Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	// changed while no server was running
+	if err := os.WriteFile(path.Join(src, "b.py"), []byte("changed"), 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	g := NewSandboxGenerations(dir, "generations_test")
+	stats, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if stats.Generation == first.Generation || stats.Reused != 1 || stats.Linked != 1 {
+		t.Fatalf("expected a new generation reusing the unchanged file, got %+v", stats)
+	}
+
+	gen := g.Acquire()
+	defer gen.Release()
+	if gen.Root() != path.Join(dir, strconv.Itoa(stats.Generation)) {
+		t.Fatalf("expected the new generation to be current, got %s", gen.Root())
+	}
+	waitGenerations(t, g, 1)
+}
+
+func TestSandboxGenerationsResumesMatchingGeneration(t *testing.T) {
+	src := t.TempDir()
+	for _, name := range []string{"a.py", "b.py"} {
+		if err := os.WriteFile(path.Join(src, name), []byte(name), 0644); err != nil {
+			t.Fatal(err)
+		}
+	}
+	dir := path.Join(t.TempDir(), "generations")
+
+	first, err := NewSandboxGenerations(dir, "generations_test").Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// nothing to resume on a fresh disk
+	if ready, err := NewSandboxGenerations(t.TempDir(), "generations_test").Resume([]string{src}); ready || err != nil {
+		t.Fatalf("expected nothing to resume, got ready=%v err=%v", ready, err)
+	}
+
+	g := NewSandboxGenerations(dir, "generations_test")
+	if ready, err := g.Resume([]string{src}); !ready || err != nil {
+		t.Fatalf("expected the unchanged generation to be resumed, got ready=%v err=%v", ready, err)
+	}
+	gen := g.Acquire()
+	if gen.Root() != path.Join(dir, strconv.Itoa(first.Generation)) {
+		t.Fatalf("expected the generation on disk to be current, got %q", gen.Root())
+	}
+	gen.Release()
+
+	// changed before the next server starts, it waits for a sync but the
+	// sync still reuses the outdated generation
+	if err := os.WriteFile(path.Join(src, "b.py"), []byte("changed"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	g = NewSandboxGenerations(dir, "generations_test")
+	if ready, err := g.Resume([]string{src}); ready || err != nil {
+		t.Fatalf("expected an outdated generation not to be resumed, got ready=%v err=%v", ready, err)
+	}
+	if g.Ready() {
+		t.Fatal("expected no current generation")
+	}
+	stats, err := g.Sync([]string{src})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if stats.Reused != 1 || stats.Linked != 1 {
+		t.Fatalf("expected the sync to reuse the outdated generation, got %+v", stats)
+	}
+	waitGenerations(t, g, 1)
+}
@@ -10,17 +10,18 @@ import (
 	"path"
 	"strconv"
 	"strings"
+	"sync"
 	"time"
 
 	"github.com/langgenius/dify-sandbox/internal/core/runner"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
 	"github.com/langgenius/dify-sandbox/internal/core/runner/types"
 	"github.com/langgenius/dify-sandbox/internal/core/runner/uidpool"
 	"github.com/langgenius/dify-sandbox/internal/static"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
-type NodeJsRunner struct {
-	runner.TempDirRunner
-}
+type NodeJsRunner struct{}
 
 //go:embed prescript.js
 var nodejs_sandbox_fs []byte
@@ -35,8 +36,33 @@ var (
 		"/run/systemd/resolve/stub-resolv.conf",
 		"/etc/hosts",
 	}
+
+	// the files of REQUIRED_FS the container runtime rewrites while the server
+	// runs, they are refreshed before every run
+	VOLATILE_FS = []string{
+		"/etc/resolv.conf",
+		"/run/systemd/resolve/stub-resolv.conf",
+		"/etc/hosts",
+	}
+
+	// every run chroots into this shared root, see InitializeEnvironment
+	sandbox_rootfs = runner.NewSandboxRootfs(path.Join(LIB_PATH, "rootfs"))
+
+	// V8 code cache data of the snippets
+	code_cache      *runner.CodeCache
+	code_cache_once sync.Once
 )
 
+func getCodeCache() *runner.CodeCache {
+	code_cache_once.Do(func() {
+		code_cache = runner.NewCodeCache(
+			metrics.LanguageNodeJs,
+			static.GetDifySandboxGlobalConfigurations().CodeCacheMaxBytes,
+		)
+	})
+	return code_cache
+}
+
 func (p *NodeJsRunner) Run(
 	ctx context.Context,
 	code string,
@@ -45,89 +71,153 @@ func (p *NodeJsRunner) Run(
 	preload string,
 	options *types.RunnerOptions,
 ) (*runner.OutputCaptureResult, error) {
+	artifact, afterReady := getCodeCache().Lookup(code, preload)
+
+	codeWriter, output_handler, err := p.start(ctx, timeout, preload, options, afterReady)
+	if err != nil {
+		return nil, err
+	}
+
+	go func() {
+		_ = runner.WriteCode(codeWriter, artifact, code)
+		codeWriter.Close()
+	}()
+
+	return output_handler.Result(), nil
+}
+
+// RunBatch starts one sandbox process which runs the code once per input,
+// the code and the inputs are sent through the returned runner.BatchPipe.
+func (p *NodeJsRunner) RunBatch(
+	ctx context.Context,
+	timeout time.Duration,
+	preload string,
+	options *types.RunnerOptions,
+) (*runner.OutputCaptureResult, *runner.BatchPipe, error) {
+	resultReader, resultWriter, err := os.Pipe()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	batchOptions := *options
+	batchOptions.Batch = true
+
+	codeWriter, output_handler, err := p.start(ctx, timeout, preload, &batchOptions, nil, resultWriter)
+	// the child owns its copy now, EOF on the reader means it exited
+	resultWriter.Close()
+	if err != nil {
+		resultReader.Close()
+		return nil, nil, err
+	}
+
+	return output_handler.Result(), &runner.BatchPipe{
+		Input:  codeWriter,
+		Output: resultReader,
+		Kill:   output_handler.Kill,
+	}, nil
+}
+
+// start launches the bootstrap with the read end of the code pipe as fd 3,
+// the ready pipe as fd 4 and extraFiles from fd 5 on. The caller writes the
+// code to codeWriter, afterReady gets what the sandbox reports on the ready
+// pipe.
+func (p *NodeJsRunner) start(
+	ctx context.Context,
+	timeout time.Duration,
+	preload string,
+	options *types.RunnerOptions,
+	afterReady func(io.Reader),
+	extraFiles ...*os.File,
+) (io.WriteCloser, *runner.OutputCaptureRunner, error) {
 	configuration := static.GetDifySandboxGlobalConfigurations()
 
+	uidWaitStart := time.Now()
 	uid, err := uidpool.AcquireUID(ctx)
 	if err != nil {
-		return nil, fmt.Errorf("no available sandbox UID: %w", err)
+		return nil, nil, fmt.Errorf("no available sandbox UID: %w", err)
+	}
+	metrics.ObservePhase(metrics.LanguageNodeJs, metrics.PhaseUIDWait, time.Since(uidWaitStart))
+
+	// initialize the environment
+	prepareStart := time.Now()
+	script_path, run_dir, err := p.InitializeEnvironment(preload)
+	if err != nil {
+		uidpool.ReleaseUID(uid)
+		return nil, nil, err
+	}
+	metrics.ObservePhase(metrics.LanguageNodeJs, metrics.PhasePrepare, time.Since(prepareStart))
+
+	codeReader, codeWriter, err := os.Pipe()
+	if err != nil {
+		os.RemoveAll(run_dir)
+		uidpool.ReleaseUID(uid)
+		return nil, nil, err
+	}
+
+	readyReader, readyWriter, err := os.Pipe()
+	if err != nil {
+		codeReader.Close()
+		codeWriter.Close()
+		os.RemoveAll(run_dir)
+		uidpool.ReleaseUID(uid)
+		return nil, nil, err
 	}
-	releaseUID := true
 
 	// capture the output
 	output_handler := runner.NewOutputCaptureRunner()
+	output_handler.SetLanguage(metrics.LanguageNodeJs)
+	output_handler.SetSandboxReady(readyReader)
+	output_handler.SetAfterReady(afterReady)
 	output_handler.SetTimeout(timeout)
+	output_handler.SetOutputLimit(configuration.MaxStdoutBytes, configuration.MaxStderrBytes)
+	output_handler.SetAfterExitHook(func() {
+		codeReader.Close()
+		codeWriter.Close()
+		os.RemoveAll(run_dir)
+		uidpool.ReleaseUID(uid)
+	})
 
-	err = p.WithTempDir("/", REQUIRED_FS, func(root_path string) error {
-		cleanupRootPath := true
-		defer func() {
-			if cleanupRootPath {
-				os.RemoveAll(root_path)
-			}
-		}()
-
-		// initialize the environment
-		script_path, err := p.InitializeEnvironment(preload, root_path)
-		if err != nil {
-			return err
-		}
-
-		codeReader, codeWriter, err := os.Pipe()
-		if err != nil {
-			return err
-		}
-		output_handler.SetAfterExitHook(func() {
-			codeReader.Close()
-			codeWriter.Close()
-			os.RemoveAll(root_path)
-			uidpool.ReleaseUID(uid)
-		})
-
-		// create a new process
-		cmd := exec.Command(configuration.NodejsPath, buildCommandArgs(script_path, uid, options)...)
-		cmd.Env = []string{
-			// The sandbox child loads a Go c-shared library to install seccomp.
-			// Disable Go runtime features that may issue housekeeping syscalls after
-			// the seccomp filter is active; the prescript removes this before running
-			// user code.
-			"GODEBUG=decoratemappings=0,containermaxprocs=0,updatemaxprocs=0",
-		}
-		cmd.ExtraFiles = []*os.File{codeReader}
-
-		if len(configuration.AllowedSyscalls) > 0 {
-			cmd.Env = append(
-				cmd.Env,
-				fmt.Sprintf("ALLOWED_SYSCALLS=%s", strings.Trim(
-					strings.Join(strings.Fields(fmt.Sprint(configuration.AllowedSyscalls)), ","), "[]",
-				)),
-			)
-		}
+	// create a new process
+	cmd := exec.Command(configuration.NodejsPath, buildCommandArgs(script_path, uid, options)...)
+	cmd.Env = []string{
+		// The sandbox child loads a Go c-shared library to install seccomp.
+		// Disable Go runtime features that may issue housekeeping syscalls after
+		// the seccomp filter is active; the prescript removes this before running
+		// user code.
+		"GODEBUG=decoratemappings=0,containermaxprocs=0,updatemaxprocs=0",
+	}
+	// the prescript loads nodejs.so relative to it and chroots into it
+	cmd.Dir = sandbox_rootfs.Root()
+	cmd.ExtraFiles = append([]*os.File{codeReader, readyWriter}, extraFiles...)
 
-		go func() {
-			_, _ = io.WriteString(codeWriter, code)
-			codeWriter.Close()
-		}()
-
-		// capture the output
-		err = output_handler.CaptureOutput(ctx, cmd)
-		if err != nil {
-			codeReader.Close()
-			codeWriter.Close()
-			return err
-		}
-		releaseUID = false
-		cleanupRootPath = false
+	if len(configuration.AllowedSyscalls) > 0 {
+		cmd.Env = append(
+			cmd.Env,
+			fmt.Sprintf("ALLOWED_SYSCALLS=%s", strings.Trim(
+				strings.Join(strings.Fields(fmt.Sprint(configuration.AllowedSyscalls)), ","), "[]",
+			)),
+		)
+	}
 
-		return nil
-	})
+	// the leaf of the uid, nil without cgroups
+	sandboxCgroup := cgroup.Begin(uid)
+	output_handler.SetCgroup(sandboxCgroup)
 
+	// capture the output
+	err = output_handler.CaptureOutput(ctx, cmd)
+	// the child owns its copy now, EOF on the reader means it exited
+	readyWriter.Close()
 	if err != nil {
-		if releaseUID {
-			uidpool.ReleaseUID(uid)
-		}
-		return nil, err
+		sandboxCgroup.Finish()
+		readyReader.Close()
+		codeReader.Close()
+		codeWriter.Close()
+		os.RemoveAll(run_dir)
+		uidpool.ReleaseUID(uid)
+		return nil, nil, err
 	}
 
-	return output_handler.Result(), nil
+	return codeWriter, output_handler, nil
 }
 
 func buildCommandArgs(scriptPath string, uid int, options *types.RunnerOptions) []string {
@@ -148,19 +238,40 @@ func buildBootstrap(preload string) string {
 	return node_sandbox_file
 }
 
-func (p *NodeJsRunner) InitializeEnvironment(preload string, root_path string) (string, error) {
+// InitializeEnvironment writes the bootstrap into a private directory inside
+// the shared sandbox root. The directory sits next to node_modules so that
+// require('koffi') resolves from the script, it is removed after the run.
+func (p *NodeJsRunner) InitializeEnvironment(preload string) (string, string, error) {
 	if !checkLibAvaliable() {
 		releaseLibBinary()
+		// the rewritten library replaces the links to the removed one
+		if err := sandbox_rootfs.Sync(REQUIRED_FS); err != nil {
+			return "", "", err
+		}
+	}
+
+	err := sandbox_rootfs.Ensure(REQUIRED_FS)
+	if err != nil {
+		return "", "", err
+	}
+	// name resolution of the run follows the container
+	if err := sandbox_rootfs.Refresh(VOLATILE_FS); err != nil {
+		return "", "", err
+	}
+
+	run_dir, err := sandbox_rootfs.CreateRunDir(path.Join(LIB_PATH, PROJECT_NAME, "node_temp"))
+	if err != nil {
+		return "", "", err
 	}
 
 	code := buildBootstrap(preload)
 
-	// override root_path/tmp/sandbox-nodejs-project/prescript.js
-	script_path := path.Join(root_path, LIB_PATH, PROJECT_NAME, "node_temp/node_temp/test.js")
-	err := os.WriteFile(script_path, []byte(code), 0755)
+	script_path := path.Join(run_dir, "test.js")
+	err = os.WriteFile(script_path, []byte(code), 0755)
 	if err != nil {
-		return "", err
+		os.RemoveAll(run_dir)
+		return "", "", err
 	}
 
-	return script_path, nil
+	return script_path, run_dir, nil
 }
@@ -1,10 +1,13 @@
 package nodejs
 
 import (
+	"os"
+	"path"
 	"strconv"
 	"strings"
 	"testing"
 
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
 	"github.com/langgenius/dify-sandbox/internal/core/runner/types"
 	"github.com/langgenius/dify-sandbox/internal/static"
 )
@@ -16,7 +19,7 @@ func TestBuildBootstrapInjectsPreloadButNotUserCode(t *testing.T) {
 		t.Fatal("expected preload in bootstrap")
 	}
 
-	if !strings.Contains(bootstrap, "readFileSync(3, 'utf8')") {
+	if !strings.Contains(bootstrap, "readFileSync(3)") {
 		t.Fatal("expected bootstrap to read code from fd 3")
 	}
 
@@ -40,3 +43,50 @@ func TestBuildCommandArgsUsesProvidedUID(t *testing.T) {
 		t.Fatal("expected command args to avoid shared sandbox uid")
 	}
 }
+
+func TestInitializeEnvironmentWritesScriptNextToNodeModules(t *testing.T) {
+	p := NodeJsRunner{}
+	script_path, run_dir, err := p.InitializeEnvironment("")
+	if err != nil {
+		t.Fatalf("initialize environment: %v", err)
+	}
+	defer os.RemoveAll(run_dir)
+
+	node_modules := path.Join(path.Dir(run_dir), "node_modules", "koffi")
+	if _, err := os.Stat(node_modules); err != nil {
+		t.Fatalf("expected koffi to be resolvable from %s: %v", script_path, err)
+	}
+
+	if _, err := os.Stat(path.Join(sandbox_rootfs.Root(), LIB_PATH, LIB_NAME)); err != nil {
+		t.Fatalf("expected %s inside the sandbox root: %v", LIB_NAME, err)
+	}
+}
+
+// BenchmarkRequestSetupCopy measures the per-request cost of the former setup,
+// copying REQUIRED_FS into a fresh temp dir and removing it afterwards.
+func BenchmarkRequestSetupCopy(b *testing.B) {
+	tempDirRunner := runner.TempDirRunner{}
+	for i := 0; i < b.N; i++ {
+		err := tempDirRunner.WithTempDir("/", REQUIRED_FS, func(root_path string) error {
+			defer os.RemoveAll(root_path)
+			script_path := path.Join(root_path, LIB_PATH, PROJECT_NAME, "node_temp/node_temp/test.js")
+			return os.WriteFile(script_path, []byte(buildBootstrap("")), 0755)
+		})
+		if err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// BenchmarkRequestSetupRootfs measures the per-request cost on the shared
+// sandbox root, which only creates and removes a private script directory.
+func BenchmarkRequestSetupRootfs(b *testing.B) {
+	p := NodeJsRunner{}
+	for i := 0; i < b.N; i++ {
+		_, run_dir, err := p.InitializeEnvironment("")
+		if err != nil {
+			b.Fatal(err)
+		}
+		os.RemoveAll(run_dir)
+	}
+}
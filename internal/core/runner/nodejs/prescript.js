@@ -1,5 +1,6 @@
 const argv = process.argv
 const fs = require('fs')
+const vm = require('vm')
 
 const koffi = require('koffi')
 const lib = koffi.load('./var/sandbox/sandbox-nodejs/nodejs.so')
@@ -13,5 +14,150 @@ const options = JSON.parse(argv[4])
 difySeccomp(uid, gid, options['enable_network'])
 delete process.env.GODEBUG
 
-const code = fs.readFileSync(3, 'utf8')
-eval(code)
+// tell the server that the sandbox is in place
+fs.writeSync(4, '\0')
+
+// batch mode: fd 3 carries the code followed by one frame per input, every
+// input is answered with one result frame on fd 5. A frame is the decimal
+// payload length, a newline and the payload.
+//
+// An item is done once the promise it evaluates to settled and the event loop
+// ran its pending promise callbacks and immediates, timers still pending then
+// write into later items.
+async function runBatch() {
+  let buffer = Buffer.alloc(0)
+  let eof = false
+
+  const readFrame = () => {
+    for (;;) {
+      const newline = buffer.indexOf(10)
+      if (newline >= 0) {
+        const end = newline + 1 + parseInt(buffer.subarray(0, newline).toString())
+        if (buffer.length >= end) {
+          const frame = buffer.subarray(newline + 1, end).toString('utf8')
+          buffer = buffer.subarray(end)
+          return frame
+        }
+      }
+      if (eof) {
+        return null
+      }
+
+      const chunk = Buffer.alloc(64 * 1024)
+      const n = fs.readSync(3, chunk, 0, chunk.length, null)
+      if (n === 0) {
+        eof = true
+      } else {
+        buffer = Buffer.concat([buffer, chunk.subarray(0, n)])
+      }
+    }
+  }
+
+  const writeFrame = (payload) => {
+    const data = Buffer.from(payload, 'utf8')
+    const frame = Buffer.concat([Buffer.from(`${data.length}\n`), data])
+    let offset = 0
+    while (offset < frame.length) {
+      offset += fs.writeSync(5, frame, offset, frame.length - offset)
+    }
+  }
+
+  // a rejection nobody handled fails the item it surfaced in instead of
+  // taking the process down
+  let current = null
+  process.on('unhandledRejection', (e) => {
+    if (current) {
+      current.stderr += `${e && e.stack ? e.stack : e}\n`
+      current.exitCode = 1
+    }
+  })
+
+  const code = readFrame()
+  for (;;) {
+    const inputs = readFrame()
+    if (inputs === null) {
+      return
+    }
+
+    const item = { stdout: '', stderr: '', exitCode: 0 }
+    current = item
+    const stdoutWrite = process.stdout.write
+    const stderrWrite = process.stderr.write
+    process.stdout.write = (chunk) => { item.stdout += chunk; return true }
+    process.stderr.write = (chunk) => { item.stderr += chunk; return true }
+    try {
+      const value = runBatchItem(code, inputs)
+      if (value && typeof value.then === 'function') {
+        await value
+      }
+    } catch (e) {
+      item.stderr += `${e && e.stack ? e.stack : e}\n`
+      item.exitCode = 1
+    }
+    await new Promise((resolve) => setImmediate(resolve))
+    process.stdout.write = stdoutWrite
+    process.stderr.write = stderrWrite
+    current = null
+
+    writeFrame(JSON.stringify({ stdout: item.stdout, stderr: item.stderr, exit_code: item.exitCode }))
+  }
+}
+
+// every item gets a fresh function scope with `inputs` bound, the completion
+// value of the code is returned
+function runBatchItem(code, inputs) {
+  return eval(code)
+}
+
+// a single run gets the cached V8 code cache data as one frame on fd 3
+// followed by the source. The source is compiled as a CommonJS style function
+// so that the code cache can be used. Used data is confirmed with an empty
+// frame after the ready byte, otherwise new data is reported there. User code
+// only runs once fd 4 is closed.
+function loadCode() {
+  const input = fs.readFileSync(3)
+  const newline = input.indexOf(10)
+  const start = newline + 1
+  const end = start + parseInt(input.subarray(0, newline).toString())
+  const cachedData = input.subarray(start, end)
+  const code = input.subarray(end).toString('utf8')
+
+  const script = new vm.Script(
+    '(function (exports, require, module, __filename, __dirname) {\n' + code + '\n})',
+    {
+      filename: 'code.js',
+      lineOffset: -1,
+      cachedData: cachedData.length > 0 ? cachedData : undefined,
+    },
+  )
+
+  try {
+    const artifact = cachedData.length === 0 || script.cachedDataRejected
+      ? script.createCachedData()
+      : Buffer.alloc(0)
+    const frame = Buffer.concat([Buffer.from(`${artifact.length}\n`), artifact])
+    let offset = 0
+    while (offset < frame.length) {
+      offset += fs.writeSync(4, frame, offset, frame.length - offset)
+    }
+  } catch (e) {
+    // the server does not wait for it
+  }
+
+  return script.runInThisContext()
+}
+
+if (options['batch']) {
+  fs.closeSync(4)
+  // every result is delivered, timers left behind by the items must not keep
+  // the process alive
+  runBatch().then(() => process.exit(0))
+} else {
+  let compiled
+  try {
+    compiled = loadCode()
+  } finally {
+    fs.closeSync(4)
+  }
+  compiled.call(module.exports, module.exports, require, module, __filename, __dirname)
+}
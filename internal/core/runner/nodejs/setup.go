@@ -26,9 +26,17 @@ func init() {
 	releaseLibBinary()
 }
 
+// PrepareSandboxRootfs syncs the shared sandbox root ahead of the first run,
+// runs otherwise build it on first use.
+func PrepareSandboxRootfs() error {
+	return sandbox_rootfs.Sync(REQUIRED_FS)
+}
+
 func releaseLibBinary() {
 	slog.Info("initializing nodejs runner environment")
-	os.RemoveAll(LIB_PATH)
+	// only the library files, the sandbox root below LIB_PATH is in use
+	os.Remove(path.Join(LIB_PATH, LIB_NAME))
+	os.RemoveAll(path.Join(LIB_PATH, PROJECT_NAME))
 
 	err := os.MkdirAll(LIB_PATH, 0755)
 	if err != nil {
@@ -5,10 +5,16 @@ import (
 	"fmt"
 	"io"
 	"log/slog"
+	"os"
 	"os/exec"
 	"strings"
 	"sync"
+	"sync/atomic"
+	"syscall"
 	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
 // OutputCaptureResult keeps raw process stderr separate from sandbox-generated
@@ -23,6 +29,19 @@ type OutputCaptureResult struct {
 
 	exitCodeMu sync.RWMutex
 	exitCode   int
+	usage      ResourceUsage
+
+	// kills the captured process, set once the capture started
+	kill func()
+}
+
+// ResourceUsage is what a finished sandbox process consumed.
+type ResourceUsage struct {
+	CPUTime time.Duration
+	// peak memory in bytes
+	MemoryPeak int64
+	// OOMKilled is set when the process hit the memory limit of its cgroup
+	OOMKilled bool
 }
 
 func NewOutputCaptureResult() *OutputCaptureResult {
@@ -62,12 +81,60 @@ func (r *OutputCaptureResult) GetExitCode() int {
 	return r.exitCode
 }
 
+func (r *OutputCaptureResult) SetUsage(usage ResourceUsage) {
+	r.exitCodeMu.Lock()
+	defer r.exitCodeMu.Unlock()
+	r.usage = usage
+}
+
+// GetUsage is valid once done was received.
+func (r *OutputCaptureResult) GetUsage() ResourceUsage {
+	r.exitCodeMu.RLock()
+	defer r.exitCodeMu.RUnlock()
+	return r.usage
+}
+
+// Kill kills the captured process, e.g. once nobody reads its output
+// anymore. The capture still finishes and sends done.
+func (r *OutputCaptureResult) Kill() {
+	if r.kill != nil {
+		r.kill()
+	}
+}
+
 type OutputCaptureRunner struct {
 	result *OutputCaptureResult
 
 	timeout time.Duration
 
+	// per stream byte limits, 0 means unlimited
+	stdoutLimit int
+	stderrLimit int
+
 	after_exit_hook func()
+
+	process Process
+
+	// a stream exceeded its limit, the run fails however the process exits
+	outputExceeded atomic.Bool
+
+	// metrics are only recorded once the language is set
+	language   string
+	ready      io.ReadCloser
+	afterReady func(io.Reader)
+
+	cgroup *cgroup.Run
+}
+
+// readBufferSize is the size of the pooled buffers the output pipes are read
+// into, each chunk handed to the result is copied out at its exact length.
+const readBufferSize = 32 * 1024
+
+var readBufferPool = sync.Pool{
+	New: func() any {
+		buf := make([]byte, readBufferSize)
+		return &buf
+	},
 }
 
 func NewOutputCaptureRunner() *OutputCaptureRunner {
@@ -102,26 +169,89 @@ func (s *OutputCaptureRunner) SetTimeout(timeout time.Duration) {
 	s.timeout = timeout
 }
 
-func (s *OutputCaptureRunner) CaptureOutput(ctx context.Context, cmd *exec.Cmd) error {
-	// start a timer for the timeout
-	timeout := s.timeout
-	if timeout == 0 {
-		timeout = 5 * time.Second
-	}
+// SetOutputLimit caps stdout and stderr, the process is killed once either
+// stream exceeds its limit. A limit of 0 disables the cap.
+func (s *OutputCaptureRunner) SetOutputLimit(stdoutLimit int, stderrLimit int) {
+	s.stdoutLimit = stdoutLimit
+	s.stderrLimit = stderrLimit
+}
 
-	timer := time.AfterFunc(timeout, func() {
-		if cmd != nil && cmd.Process != nil {
-			s.result.SetExitCode(-1)
-			s.WriteExecError([]byte("error: timeout\n"))
-			// send a signal to the process
-			cmd.Process.Kill()
-		}
-	})
+// SetLanguage labels the metrics of the captured process.
+func (s *OutputCaptureRunner) SetLanguage(language string) {
+	s.language = language
+}
+
+// SetSandboxReady sets the read end of the ready pipe, the sandboxed process
+// writes one byte to it right before running user code. It is closed once
+// the capture finished.
+func (s *OutputCaptureRunner) SetSandboxReady(ready io.ReadCloser) {
+	s.ready = ready
+}
+
+// SetAfterReady sets a hook which gets the rest of the ready pipe once the
+// ready byte arrived, the sandbox reports there what it produced before user
+// code runs.
+func (s *OutputCaptureRunner) SetAfterReady(hook func(io.Reader)) {
+	s.afterReady = hook
+}
+
+// SetCgroup sets the cgroup leaf the process runs in. CaptureOutput moves the
+// started process into it, a killed process takes everything in the leaf
+// with it and the usage of the leaf is reported once the process exited.
+func (s *OutputCaptureRunner) SetCgroup(run *cgroup.Run) {
+	s.cgroup = run
+}
+
+// ProcessStatus is the exit status of a finished sandbox process.
+type ProcessStatus struct {
+	ExitCode int
+	// Status is the human readable status, e.g. "exit status 1" or
+	// "signal: bad system call".
+	Status string
+
+	// resource usage of the process, zero when unknown
+	UserTime   time.Duration
+	SystemTime time.Duration
+	MaxRSS     int64
+}
+
+// Process is a started sandbox process whose lifetime is managed by the
+// output capture, either an os/exec child or a child forked by a zygote.
+type Process interface {
+	Kill() error
+	Wait() (*ProcessStatus, error)
+}
 
+type execProcess struct {
+	process *os.Process
+}
+
+func (p *execProcess) Kill() error {
+	return p.process.Kill()
+}
+
+func (p *execProcess) Wait() (*ProcessStatus, error) {
+	status, err := p.process.Wait()
+	if status == nil {
+		return nil, err
+	}
+	processStatus := &ProcessStatus{
+		ExitCode: status.ExitCode(),
+		Status:   status.String(),
+	}
+	if rusage, ok := status.SysUsage().(*syscall.Rusage); ok && rusage != nil {
+		processStatus.UserTime = time.Duration(rusage.Utime.Nano())
+		processStatus.SystemTime = time.Duration(rusage.Stime.Nano())
+		// ru_maxrss is in kilobytes on linux
+		processStatus.MaxRSS = int64(rusage.Maxrss) * 1024
+	}
+	return processStatus, err
+}
+
+func (s *OutputCaptureRunner) CaptureOutput(ctx context.Context, cmd *exec.Cmd) error {
 	// create a pipe for the stdout
 	stdoutReader, err := cmd.StdoutPipe()
 	if err != nil {
-		timer.Stop()
 		return err
 	}
 
@@ -129,60 +259,92 @@ func (s *OutputCaptureRunner) CaptureOutput(ctx context.Context, cmd *exec.Cmd)
 	stderrReader, err := cmd.StderrPipe()
 	if err != nil {
 		stdoutReader.Close()
-		timer.Stop()
 		return err
 	}
 
 	// start the process
+	startedAt := time.Now()
 	err = cmd.Start()
 	if err != nil {
 		stdoutReader.Close()
 		stderrReader.Close()
-		timer.Stop()
 		return err
 	}
+	s.observePhase(metrics.PhaseStart, time.Since(startedAt))
+
+	// user code is only sent after this returned, so it runs in the leaf
+	if err := s.cgroup.Attach(cmd.Process.Pid); err != nil {
+		slog.WarnContext(ctx, "failed to move the sandbox process into its cgroup", "err", err)
+	}
+
+	s.CaptureProcessOutput(ctx, &execProcess{process: cmd.Process}, stdoutReader, stderrReader)
+	return nil
+}
+
+// CaptureProcessOutput captures an already started process. stdoutReader and
+// stderrReader are the read ends of the process output pipes, they are closed
+// once drained.
+func (s *OutputCaptureRunner) CaptureProcessOutput(
+	ctx context.Context,
+	process Process,
+	stdoutReader io.ReadCloser,
+	stderrReader io.ReadCloser,
+) {
+	if s.cgroup != nil {
+		process = &cgroupProcess{Process: process, cgroup: s.cgroup}
+	}
+	s.process = process
+	s.result.kill = func() { process.Kill() }
+	startedAt := time.Now()
+
+	// start a timer for the timeout
+	timeout := s.timeout
+	if timeout == 0 {
+		timeout = 5 * time.Second
+	}
+
+	timer := time.AfterFunc(timeout, func() {
+		s.result.SetExitCode(-1)
+		s.WriteExecError([]byte("error: timeout\n"))
+		if s.language != "" {
+			metrics.RunTimeouts.Inc(s.language)
+		}
+		// send a signal to the process
+		process.Kill()
+	})
 
 	wg := sync.WaitGroup{}
 	wg.Add(2)
 
+	// zero unless the sandbox reported ready, e.g. the preload failed
+	var readyAt time.Time
+	if s.ready != nil {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			defer s.ready.Close()
+			if n, _ := s.ready.Read(make([]byte, 1)); n == 1 {
+				readyAt = time.Now()
+				s.observePhase(metrics.PhaseSeccomp, readyAt.Sub(startedAt))
+				if s.afterReady != nil {
+					s.afterReady(s.ready)
+				}
+			}
+		}()
+	}
+
 	// read the output
 	go func() {
 		defer wg.Done()
 		defer stdoutReader.Close()
-		for {
-			buf := make([]byte, 1024)
-			n, err := stdoutReader.Read(buf)
-			// exit if EOF
-			if err != nil {
-				if err == io.EOF {
-					break
-				} else {
-					s.WriteExecError([]byte(fmt.Sprintf("error: %v\n", err)))
-					break
-				}
-			}
-			s.WriteOutput(buf[:n])
-		}
+		s.readStream("stdout", stdoutReader, s.stdoutLimit, s.WriteOutput, process)
 	}()
 
 	// read the error
 	go func() {
-		buf := make([]byte, 1024)
 		defer wg.Done()
 		defer stderrReader.Close()
-		for {
-			n, err := stderrReader.Read(buf)
-			// exit if EOF
-			if err != nil {
-				if err == io.EOF {
-					break
-				} else {
-					s.WriteExecError([]byte(fmt.Sprintf("error: %v\n", err)))
-					break
-				}
-			}
-			s.WriteStderr(buf[:n])
-		}
+		s.readStream("stderr", stderrReader, s.stderrLimit, s.WriteStderr, process)
 	}()
 
 	// wait for the process to finish
@@ -191,13 +353,22 @@ func (s *OutputCaptureRunner) CaptureOutput(ctx context.Context, cmd *exec.Cmd)
 
 		// wait for the stdout and stderr to finish
 		wg.Wait()
+		exitedAt := time.Now()
+		if !readyAt.IsZero() {
+			s.observePhase(metrics.PhaseRun, exitedAt.Sub(readyAt))
+		}
 
 		// wait for the process to finish
-		status, err := cmd.Process.Wait()
+		status, err := process.Wait()
+		if status != nil && s.language != "" {
+			metrics.ObserveUsage(s.language, status.UserTime, status.SystemTime, status.MaxRSS)
+		}
+		usage := s.collectUsage(status)
+		s.result.SetUsage(usage)
 		if err != nil {
 			statusText := ""
 			if status != nil {
-				statusText = status.String()
+				statusText = status.Status
 			}
 			slog.ErrorContext(ctx, "process finished with error", "status", statusText, "err", err)
 			if s.result.GetExitCode() == 0 {
@@ -205,24 +376,137 @@ func (s *OutputCaptureRunner) CaptureOutput(ctx context.Context, cmd *exec.Cmd)
 			}
 			s.WriteExecError([]byte(fmt.Sprintf("error: %v\n", err)))
 		} else if status != nil {
-			s.result.SetExitCode(status.ExitCode())
-			if status.ExitCode() != 0 {
-				exitString := status.String()
-				slog.ErrorContext(ctx, "process finished with error", "status", exitString)
-				if strings.Contains(exitString, "bad system call") {
+			s.result.SetExitCode(status.ExitCode)
+			if status.ExitCode != 0 {
+				slog.ErrorContext(ctx, "process finished with error", "status", status.Status)
+				if strings.Contains(status.Status, "bad system call") {
 					s.WriteExecError([]byte("error: operation not permitted\n"))
+					if s.language != "" {
+						metrics.SeccompKills.Inc(s.language)
+					}
 				}
 			}
 		}
+		if s.outputExceeded.Load() {
+			s.result.SetExitCode(-1)
+		}
+		if usage.OOMKilled {
+			s.result.SetExitCode(-1)
+			s.WriteExecError([]byte("error: memory limit exceeded\n"))
+			if s.language != "" {
+				metrics.OOMKills.Inc(s.language)
+			}
+		}
 
 		if s.after_exit_hook != nil {
 			s.after_exit_hook()
 		}
 
 		s.result.done <- true
+		s.observePhase(metrics.PhaseOutput, time.Since(exitedAt))
 	}()
+}
 
-	return nil
+// collectUsage merges the rusage of the reaped process with the counters of
+// its cgroup leaf, see mergeUsage.
+func (s *OutputCaptureRunner) collectUsage(status *ProcessStatus) ResourceUsage {
+	if s.cgroup == nil {
+		return mergeUsage(status, cgroup.Stats{})
+	}
+	return mergeUsage(status, s.cgroup.Finish())
+}
+
+// mergeUsage reports the larger cpu time of rusage and the leaf. rusage
+// covers the process from its start, the leaf only since the process was
+// moved in but also children which were not reaped. The memory peak of the
+// leaf is preferred when known, it only holds what the run allocated. The
+// max rss of a process also counts pages shared with its parent, for zygote
+// children it is reduced by the zygote's resident set.
+func mergeUsage(status *ProcessStatus, stats cgroup.Stats) ResourceUsage {
+	usage := ResourceUsage{
+		CPUTime:    stats.CPUTime,
+		MemoryPeak: stats.MemoryPeak,
+		OOMKilled:  stats.OOMKilled,
+	}
+	if status != nil {
+		usage.CPUTime = max(usage.CPUTime, status.UserTime+status.SystemTime)
+		if usage.MemoryPeak == 0 {
+			usage.MemoryPeak = status.MaxRSS
+		}
+	}
+	return usage
+}
+
+// cgroupProcess kills the whole cgroup leaf along with the process, so that
+// children holding the output pipes open cannot keep a killed run alive.
+type cgroupProcess struct {
+	Process
+	cgroup *cgroup.Run
+}
+
+func (p *cgroupProcess) Kill() error {
+	err := p.Process.Kill()
+	p.cgroup.Kill()
+	return err
+}
+
+func (s *OutputCaptureRunner) observePhase(phase string, duration time.Duration) {
+	if s.language != "" {
+		metrics.ObservePhase(s.language, phase, duration)
+	}
+}
+
+// readStream forwards reader to write until EOF. Once more than limit bytes
+// were forwarded the process is killed and the rest of the stream is drained
+// without being kept.
+func (s *OutputCaptureRunner) readStream(
+	name string,
+	reader io.Reader,
+	limit int,
+	write func([]byte),
+	process Process,
+) {
+	bufPtr := readBufferPool.Get().(*[]byte)
+	defer readBufferPool.Put(bufPtr)
+	buf := *bufPtr
+
+	total := 0
+	exceeded := false
+	for {
+		n, err := reader.Read(buf)
+		if n > 0 && !exceeded {
+			chunk := buf[:n]
+			if limit > 0 && total+n > limit {
+				chunk = chunk[:limit-total]
+				exceeded = true
+			}
+			total += len(chunk)
+			if len(chunk) > 0 {
+				write(append([]byte(nil), chunk...))
+			}
+			if exceeded {
+				s.outputExceeded.Store(true)
+				s.result.SetExitCode(-1)
+				s.WriteExecError([]byte(fmt.Sprintf("error: %s exceeded the limit of %d bytes\n", name, limit)))
+				process.Kill()
+			}
+		}
+		// exit if EOF
+		if err != nil {
+			if err != io.EOF {
+				s.WriteExecError([]byte(fmt.Sprintf("error: %v\n", err)))
+			}
+			return
+		}
+	}
+}
+
+// Kill terminates the captured process, it is a no-op before the capture
+// started.
+func (s *OutputCaptureRunner) Kill() {
+	if s.process != nil {
+		s.process.Kill()
+	}
 }
 
 func (s *OutputCaptureRunner) Result() *OutputCaptureResult {
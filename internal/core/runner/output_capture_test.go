@@ -1,11 +1,18 @@
 package runner
 
 import (
+	"bytes"
 	"context"
+	"io"
+	"os"
 	"os/exec"
+	"strconv"
 	"strings"
 	"testing"
 	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
 type capturedOutput struct {
@@ -85,6 +92,139 @@ func TestCaptureOutputReportsTimeoutAsExecutionError(t *testing.T) {
 	}
 }
 
+func TestCaptureOutputKillsProcessExceedingStdoutLimit(t *testing.T) {
+	r := NewOutputCaptureRunner()
+	r.SetOutputLimit(4096, 0)
+	cmd := exec.Command("/bin/sh", "-c", "while true; do echo 0123456789; done")
+
+	if err := r.CaptureOutput(context.Background(), cmd); err != nil {
+		t.Fatalf("capture output failed: %v", err)
+	}
+
+	output := collectCapturedOutput(r.Result())
+
+	if len(output.stdout) != 4096 {
+		t.Fatalf("expected stdout to be cut at 4096 bytes, got %d", len(output.stdout))
+	}
+
+	if !strings.Contains(output.execError, "error: stdout exceeded the limit of 4096 bytes") {
+		t.Fatalf("expected limit execution error, got %q", output.execError)
+	}
+
+	if output.exitCode != -1 {
+		t.Fatalf("expected exit code -1, got %d", output.exitCode)
+	}
+}
+
+type fakeProcess struct {
+	status *ProcessStatus
+	killed chan struct{}
+	exited chan struct{}
+}
+
+func (p *fakeProcess) Kill() error {
+	close(p.killed)
+	return nil
+}
+
+func (p *fakeProcess) Wait() (*ProcessStatus, error) {
+	<-p.exited
+	return p.status, nil
+}
+
+func TestCaptureProcessOutputUsesProcessStatus(t *testing.T) {
+	r := NewOutputCaptureRunner()
+	stdoutReader, stdoutWriter := io.Pipe()
+	stderrReader, stderrWriter := io.Pipe()
+	process := &fakeProcess{
+		status: &ProcessStatus{ExitCode: -1, Status: "signal: bad system call"},
+		killed: make(chan struct{}),
+		exited: make(chan struct{}),
+	}
+
+	r.CaptureProcessOutput(context.Background(), process, stdoutReader, stderrReader)
+
+	go func() {
+		stdoutWriter.Write([]byte("partial\n"))
+		stdoutWriter.Close()
+		stderrWriter.Close()
+		close(process.exited)
+	}()
+
+	output := collectCapturedOutput(r.Result())
+
+	if output.stdout != "partial\n" {
+		t.Fatalf("expected stdout to be captured, got %q", output.stdout)
+	}
+
+	if output.exitCode != -1 {
+		t.Fatalf("expected exit code -1, got %d", output.exitCode)
+	}
+
+	if !strings.Contains(output.execError, "error: operation not permitted") {
+		t.Fatalf("expected seccomp kill to be reported, got %q", output.execError)
+	}
+}
+
+func TestCaptureProcessOutputReportsResourceUsage(t *testing.T) {
+	r := NewOutputCaptureRunner()
+	stdoutReader, stdoutWriter := io.Pipe()
+	stderrReader, stderrWriter := io.Pipe()
+	process := &fakeProcess{
+		status: &ProcessStatus{
+			Status:     "exit status 0",
+			UserTime:   300 * time.Millisecond,
+			SystemTime: 200 * time.Millisecond,
+			MaxRSS:     32 << 20,
+		},
+		killed: make(chan struct{}),
+		exited: make(chan struct{}),
+	}
+
+	r.CaptureProcessOutput(context.Background(), process, stdoutReader, stderrReader)
+
+	stdoutWriter.Close()
+	stderrWriter.Close()
+	close(process.exited)
+	collectCapturedOutput(r.Result())
+
+	usage := r.Result().GetUsage()
+	if usage.CPUTime != 500*time.Millisecond {
+		t.Fatalf("expected user and system time to be added up, got %v", usage.CPUTime)
+	}
+	if usage.MemoryPeak != 32<<20 {
+		t.Fatalf("expected the max rss as memory peak without a cgroup, got %d", usage.MemoryPeak)
+	}
+	if usage.OOMKilled {
+		t.Fatalf("expected no oom kill without a cgroup")
+	}
+}
+
+func TestCaptureProcessOutputKeepsLimitFailureAfterCleanExit(t *testing.T) {
+	r := NewOutputCaptureRunner()
+	r.SetOutputLimit(4, 0)
+	stderrReader, stderrWriter := io.Pipe()
+	// the process already exited cleanly, its output is still in the pipe
+	process := &fakeProcess{
+		status: &ProcessStatus{ExitCode: 0, Status: "exit status 0"},
+		killed: make(chan struct{}),
+		exited: make(chan struct{}),
+	}
+	close(process.exited)
+
+	r.CaptureProcessOutput(context.Background(), process, io.NopCloser(strings.NewReader("0123456789")), stderrReader)
+	stderrWriter.Close()
+
+	output := collectCapturedOutput(r.Result())
+
+	if output.stdout != "0123" {
+		t.Fatalf("expected stdout to be cut at 4 bytes, got %q", output.stdout)
+	}
+	if output.exitCode != -1 {
+		t.Fatalf("expected the limit to fail the run despite the clean exit, got %d", output.exitCode)
+	}
+}
+
 func collectCapturedOutput(result *OutputCaptureResult) capturedOutput {
 	var output capturedOutput
 
@@ -113,3 +253,101 @@ func collectCapturedOutput(result *OutputCaptureResult) capturedOutput {
 		}
 	}
 }
+
+func TestCaptureOutputRecordsPhaseMetrics(t *testing.T) {
+	readyReader, readyWriter, err := os.Pipe()
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	r := NewOutputCaptureRunner()
+	r.SetLanguage("capture_test")
+	r.SetSandboxReady(readyReader)
+	cmd := exec.Command("/bin/sh", "-c", "printf '\\0' >&3; exec 3>&-; echo hi")
+	cmd.ExtraFiles = []*os.File{readyWriter}
+
+	err = r.CaptureOutput(context.Background(), cmd)
+	readyWriter.Close()
+	if err != nil {
+		t.Fatalf("capture output failed: %v", err)
+	}
+	collectCapturedOutput(r.Result())
+	// the output phase is observed after done was delivered
+	time.Sleep(10 * time.Millisecond)
+
+	var text bytes.Buffer
+	metrics.DefaultRegistry.WriteText(&text)
+
+	for _, phase := range []string{"start", "seccomp", "run", "output"} {
+		series := `dify_sandbox_run_phase_seconds_count{language="capture_test",phase="` + phase + `"} 1`
+		if !strings.Contains(text.String(), series) {
+			t.Fatalf("expected %s in metrics output", series)
+		}
+	}
+	if !strings.Contains(text.String(), `dify_sandbox_max_rss_bytes_count{language="capture_test"} 1`) {
+		t.Fatalf("expected the process max rss to be observed")
+	}
+}
+
+func BenchmarkCaptureOutput(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		r := NewOutputCaptureRunner()
+		cmd := exec.Command("/bin/sh", "-c", "printf 'hello\\n'")
+		if err := r.CaptureOutput(context.Background(), cmd); err != nil {
+			b.Fatal(err)
+		}
+		collectCapturedOutput(r.Result())
+	}
+}
+
+// BenchmarkCaptureProcessOutput measures the capture pipeline alone, without
+// starting a process.
+func BenchmarkCaptureProcessOutput(b *testing.B) {
+	for _, size := range []int{1 << 10, 64 << 10, 1 << 20} {
+		payload := bytes.Repeat([]byte("x"), size)
+		b.Run(strconv.Itoa(size), func(b *testing.B) {
+			b.SetBytes(int64(size))
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				r := NewOutputCaptureRunner()
+				stdoutReader, stdoutWriter := io.Pipe()
+				stderrReader, stderrWriter := io.Pipe()
+				process := &fakeProcess{
+					status: &ProcessStatus{Status: "exit status 0"},
+					killed: make(chan struct{}),
+					exited: make(chan struct{}),
+				}
+
+				r.CaptureProcessOutput(context.Background(), process, stdoutReader, stderrReader)
+
+				go func() {
+					stdoutWriter.Write(payload)
+					stdoutWriter.Close()
+					stderrWriter.Close()
+					close(process.exited)
+				}()
+
+				if output := collectCapturedOutput(r.Result()); len(output.stdout) != size {
+					b.Fatalf("expected %d bytes of stdout, got %d", size, len(output.stdout))
+				}
+			}
+		})
+	}
+}
+
+func TestMergeUsagePrefersCgroupMemoryPeak(t *testing.T) {
+	status := &ProcessStatus{UserTime: 100 * time.Millisecond, MaxRSS: 96 << 20}
+
+	usage := mergeUsage(status, cgroup.Stats{CPUTime: 50 * time.Millisecond, MemoryPeak: 8 << 20})
+	if usage.MemoryPeak != 8<<20 {
+		t.Fatalf("expected the peak of the leaf, got %d", usage.MemoryPeak)
+	}
+	if usage.CPUTime != 100*time.Millisecond {
+		t.Fatalf("expected the larger cpu time, got %v", usage.CPUTime)
+	}
+
+	// the kernel could not reset memory.peak for the run
+	if usage := mergeUsage(status, cgroup.Stats{}); usage.MemoryPeak != 96<<20 {
+		t.Fatalf("expected the max rss without a leaf peak, got %d", usage.MemoryPeak)
+	}
+}
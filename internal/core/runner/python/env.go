@@ -3,51 +3,129 @@
 package python
 
 import (
-	_ "embed"
+	"errors"
 	"log/slog"
 	"os"
-	"os/exec"
 	"path"
+	"strings"
+	"sync"
 
 	"github.com/langgenius/dify-sandbox/internal/core/runner"
 	"github.com/langgenius/dify-sandbox/internal/static"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
-//go:embed env.sh
-var env_script string
+// sandbox runs chroot into the current generation of the python environment,
+// see runner.SandboxGenerations
+var sandboxGenerations = runner.NewSandboxGenerations(
+	path.Join(LIB_PATH, "generations"), metrics.LanguagePython3,
+)
+
+// ErrSandboxEnvNotReady is returned for runs before the first sync or resume,
+// LIB_PATH itself holds every generation and is never a chroot.
+var ErrSandboxEnvNotReady = errors.New("python sandbox environment is not prepared yet")
+
+var removeLegacyCopyOnce sync.Once
 
+func init() {
+	metrics.DefaultRegistry.Register(metrics.NewGaugeFunc(
+		"dify_sandbox_python_env_generations",
+		"Python sandbox environment generations on disk, the current one and those still used by runs.",
+		func() float64 {
+			return float64(sandboxGenerations.Len())
+		},
+	))
+}
+
+// ResumePythonDependenciesEnv makes the generation a previous server left
+// behind current if the python library paths did not change since, so that
+// runs need not wait for the dependencies to be installed and synced. It
+// reports whether runs can start.
+func ResumePythonDependenciesEnv() (bool, error) {
+	return sandboxGenerations.Resume(pythonLibPaths())
+}
+
+// PreparePythonDependenciesEnv syncs the python library paths into a new
+// generation of the sandbox environment. Runs in flight keep their
+// generation, new runs start in the new one.
 func PreparePythonDependenciesEnv() error {
 	config := static.GetDifySandboxGlobalConfigurations()
 
-	runner := runner.TempDirRunner{}
-	err := runner.WithTempDir("/", []string{}, func(root_path string) error {
-		err := os.WriteFile(path.Join(root_path, "env.sh"), []byte(env_script), 0755)
-		if err != nil {
-			return err
+	stats, err := sandboxGenerations.Sync(pythonLibPaths())
+	if err != nil {
+		return err
+	}
+
+	slog.Info("python sandbox environment synced",
+		"generation", stats.Generation,
+		"switched", stats.Switched,
+		"files", stats.Files,
+		"linked", stats.Linked,
+		"copied", stats.Copied,
+		"reused", stats.Reused,
+		"duration", stats.Duration,
+	)
+
+	if stats.Switched {
+		// warm interpreters imported the previous dependencies
+		drainZygotes()
+	}
+
+	removeLegacyCopyOnce.Do(func() {
+		removeLegacyCopy(config.PythonLibPaths)
+	})
+	return nil
+}
+
+func pythonLibPaths() []string {
+	lib_paths := []string{}
+	for _, lib_path := range static.GetDifySandboxGlobalConfigurations().PythonLibPaths {
+		// check if the lib path is available
+		if _, err := os.Stat(lib_path); err != nil {
+			slog.Warn("python lib path is not available", "path", lib_path)
+			continue
 		}
+		lib_paths = append(lib_paths, lib_path)
+	}
+	return lib_paths
+}
 
-		for _, lib_path := range config.PythonLibPaths {
-			// check if the lib path is available
-			if _, err := os.Stat(lib_path); err != nil {
-				slog.Warn("python lib path is not available", "path", lib_path)
-				continue
-			}
-			exec_cmd := exec.Command(
-				"bash",
-				path.Join(root_path, "env.sh"),
-				lib_path,
-				LIB_PATH,
-			)
-			exec_cmd.Stderr = os.Stderr
-
-			if err := exec_cmd.Run(); err != nil {
-				return err
+// removeLegacyCopy removes the copies env.sh made of lib_paths directly
+// below LIB_PATH, which used to be the chroot of the runs. Anything else
+// left there is not visible to runs anymore and only logged.
+func removeLegacyCopy(lib_paths []string) {
+	keep := map[string]bool{LIB_NAME: true, "tmp": true, "generations": true}
+
+	for _, lib_path := range lib_paths {
+		copied := path.Join(LIB_PATH, lib_path)
+		top, _, _ := strings.Cut(strings.TrimPrefix(copied, LIB_PATH+"/"), "/")
+		if !path.IsAbs(lib_path) || !strings.HasPrefix(copied, LIB_PATH+"/") || keep[top] {
+			continue
+		}
+		if _, err := os.Lstat(copied); err != nil {
+			continue
+		}
+		if err := os.RemoveAll(copied); err != nil {
+			slog.Warn("failed to remove the legacy python sandbox copy", "path", copied, "err", err)
+			continue
+		}
+		// the parents env.sh created, unless something else lives there
+		for dir := path.Dir(copied); dir != LIB_PATH; dir = path.Dir(dir) {
+			if os.Remove(dir) != nil {
+				break
 			}
 		}
+		slog.Info("removed the legacy python sandbox copy", "path", copied)
+	}
 
-		os.RemoveAll(root_path)
-		return nil
-	})
-
-	return err
+	entries, err := os.ReadDir(LIB_PATH)
+	if err != nil {
+		return
+	}
+	for _, entry := range entries {
+		if !keep[entry.Name()] {
+			slog.Warn("file in the python sandbox directory is not visible to runs, install it into python_path or a system library path",
+				"path", path.Join(LIB_PATH, entry.Name()))
+		}
+	}
 }
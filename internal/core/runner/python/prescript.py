@@ -1,4 +1,9 @@
+import contextlib
 import ctypes
+import importlib.util
+import io
+import json
+import marshal
 import os
 import sys
 import traceback
@@ -26,10 +31,107 @@ os.chdir(running_path)
 
 {{preload}}
 
+
+# batch mode: fd 3 carries the code followed by one frame per input, every
+# input is answered with one result frame on fd 5. A frame is the decimal
+# payload length, a newline and the payload.
+def read_frame(fd):
+    header = fd.readline()
+    if not header:
+        return None
+    return fd.read(int(header))
+
+
+def write_frame(fd, payload):
+    fd.write(b"%d\n" % len(payload))
+    fd.write(payload)
+    fd.flush()
+
+
+def batch_exit_code(e):
+    if e.code is None:
+        return 0
+    if isinstance(e.code, int):
+        return e.code
+    sys.stderr.write("%s\n" % e.code)
+    return 1
+
+
+def run_batch(code_fd, result_fd):
+    code = compile(read_frame(code_fd).decode("utf-8"), "<fd3>", "exec")
+    while True:
+        inputs = read_frame(code_fd)
+        if inputs is None:
+            return
+
+        stdout, stderr = io.StringIO(), io.StringIO()
+        exit_code = 0
+        with contextlib.redirect_stdout(stdout), contextlib.redirect_stderr(stderr):
+            try:
+                exec(code, {"__name__": "__main__", "inputs": inputs.decode("utf-8")})
+            except SystemExit as e:
+                exit_code = batch_exit_code(e)
+            except BaseException:
+                # same as an uncaught error of a nodejs batch item
+                traceback.print_exc()
+                exit_code = 1
+
+        write_frame(result_fd, json.dumps({
+            "stdout": stdout.getvalue(),
+            "stderr": stderr.getvalue(),
+            "exit_code": exit_code & 0xFF,
+        }).encode("utf-8"))
+
+
+# a single run gets the cached code object as one frame on fd 3 followed by
+# the source. A used one is confirmed with an empty frame after the ready
+# byte, otherwise the source is compiled and the marshalled code object is
+# reported there. User code only runs once fd 4 is closed.
+def load_code(code_fd):
+    artifact = read_frame(code_fd)
+    code = code_fd.read().decode("utf-8")
+
+    magic = importlib.util.MAGIC_NUMBER
+    if artifact and artifact.startswith(magic):
+        try:
+            code_object = marshal.loads(artifact[len(magic):])
+        except Exception:
+            pass
+        else:
+            try:
+                os.write(4, b"0\n")
+            except OSError:
+                pass
+            return code_object
+
+    code_object = compile(code, "<fd3>", "exec")
+    try:
+        artifact = magic + marshal.dumps(code_object)
+        os.write(4, b"%d\n" % len(artifact))
+        view = memoryview(artifact)
+        while view:
+            view = view[os.write(4, view):]
+    except (OSError, ValueError):
+        pass
+    return code_object
+
+
 lib.DifySeccomp({{uid}}, {{gid}}, {{enable_network}})
 os.environ.pop("GODEBUG", None)
 
-with os.fdopen(3, "rb") as code_fd:
-    code = code_fd.read().decode("utf-8")
+# tell the server that the sandbox is in place
+os.write(4, b"\0")
+
+if {{batch}}:
+    os.close(4)
+    with os.fdopen(3, "rb") as code_fd, os.fdopen(5, "wb") as result_fd:
+        run_batch(code_fd, result_fd)
+    sys.exit(0)
+
+try:
+    with os.fdopen(3, "rb") as code_fd:
+        code_object = load_code(code_fd)
+finally:
+    os.close(4)
 
-exec(compile(code, "<fd3>", "exec"))
+exec(code_object)
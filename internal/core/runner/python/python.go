@@ -10,13 +10,17 @@ import (
 	"path"
 	"strconv"
 	"strings"
+	"sync"
 	"syscall"
 	"time"
 
 	"github.com/google/uuid"
 	"github.com/langgenius/dify-sandbox/internal/core/runner"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
 	"github.com/langgenius/dify-sandbox/internal/core/runner/types"
 	"github.com/langgenius/dify-sandbox/internal/static"
+	types_config "github.com/langgenius/dify-sandbox/internal/types"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
 type PythonRunner struct {
@@ -26,6 +30,23 @@ type PythonRunner struct {
 //go:embed prescript.py
 var sandbox_fs []byte
 
+var (
+	codeCache     *runner.CodeCache
+	codeCacheOnce sync.Once
+)
+
+// getCodeCache returns the cache of marshalled code objects shared by the
+// cold and the zygote runs.
+func getCodeCache() *runner.CodeCache {
+	codeCacheOnce.Do(func() {
+		codeCache = runner.NewCodeCache(
+			metrics.LanguagePython3,
+			static.GetDifySandboxGlobalConfigurations().CodeCacheMaxBytes,
+		)
+	})
+	return codeCache
+}
+
 func (p *PythonRunner) Run(
 	ctx context.Context,
 	code string,
@@ -36,38 +57,131 @@ func (p *PythonRunner) Run(
 ) (*runner.OutputCaptureResult, error) {
 	configuration := static.GetDifySandboxGlobalConfigurations()
 
+	// preload runs before the sandbox is applied, it needs a fresh interpreter
+	if configuration.PythonZygote.Enabled && preload == "" {
+		return p.runInZygote(ctx, code, timeout, options)
+	}
+
+	artifact, afterReady := getCodeCache().Lookup(code, preload)
+
+	codeWriter, outputHandler, err := p.start(ctx, timeout, preload, options, afterReady)
+	if err != nil {
+		return nil, err
+	}
+
+	go func() {
+		_ = runner.WriteCode(codeWriter, artifact, code)
+		codeWriter.Close()
+	}()
+
+	return outputHandler.Result(), nil
+}
+
+// RunBatch starts one sandbox process which runs the code once per input,
+// the code and the inputs are sent through the returned runner.BatchPipe.
+// Batches always start a fresh interpreter, the zygote only runs single
+// snippets.
+func (p *PythonRunner) RunBatch(
+	ctx context.Context,
+	timeout time.Duration,
+	preload string,
+	options *types.RunnerOptions,
+) (*runner.OutputCaptureResult, *runner.BatchPipe, error) {
+	resultReader, resultWriter, err := os.Pipe()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	batchOptions := *options
+	batchOptions.Batch = true
+
+	codeWriter, outputHandler, err := p.start(ctx, timeout, preload, &batchOptions, nil, resultWriter)
+	// the child owns its copy now, EOF on the reader means it exited
+	resultWriter.Close()
+	if err != nil {
+		resultReader.Close()
+		return nil, nil, err
+	}
+
+	return outputHandler.Result(), &runner.BatchPipe{
+		Input:  codeWriter,
+		Output: resultReader,
+		Kill:   outputHandler.Kill,
+	}, nil
+}
+
+// start launches the bootstrap with the read end of the code pipe as fd 3,
+// the ready pipe as fd 4 and extraFiles from fd 5 on. The caller writes the
+// code to codeWriter, afterReady gets what the sandbox reports on the ready
+// pipe.
+func (p *PythonRunner) start(
+	ctx context.Context,
+	timeout time.Duration,
+	preload string,
+	options *types.RunnerOptions,
+	afterReady func(io.Reader),
+	extraFiles ...*os.File,
+) (io.WriteCloser, *runner.OutputCaptureRunner, error) {
+	configuration := static.GetDifySandboxGlobalConfigurations()
+
+	if !sandboxGenerations.Ready() {
+		return nil, nil, ErrSandboxEnvNotReady
+	}
+
+	uidWaitStart := time.Now()
 	uid, err := AcquireUID(ctx)
 	if err != nil {
-		return nil, fmt.Errorf("no available sandbox UID: %w", err)
+		return nil, nil, fmt.Errorf("no available sandbox UID: %w", err)
 	}
+	metrics.ObservePhase(metrics.LanguagePython3, metrics.PhaseUIDWait, time.Since(uidWaitStart))
 
+	prepareStart := time.Now()
 	bootstrapPath, err := p.InitializeEnvironment(preload, options, uid)
 	if err != nil {
 		ReleaseUID(uid)
-		return nil, err
+		return nil, nil, err
 	}
+	metrics.ObservePhase(metrics.LanguagePython3, metrics.PhasePrepare, time.Since(prepareStart))
 
 	codeReader, codeWriter, err := os.Pipe()
 	if err != nil {
 		os.Remove(bootstrapPath)
 		ReleaseUID(uid)
-		return nil, err
+		return nil, nil, err
 	}
 
+	readyReader, readyWriter, err := os.Pipe()
+	if err != nil {
+		codeReader.Close()
+		codeWriter.Close()
+		os.Remove(bootstrapPath)
+		ReleaseUID(uid)
+		return nil, nil, err
+	}
+
+	// the run keeps its environment generation even if a sync replaces it
+	generation := sandboxGenerations.Acquire()
+
 	outputHandler := runner.NewOutputCaptureRunner()
+	outputHandler.SetLanguage(metrics.LanguagePython3)
+	outputHandler.SetSandboxReady(readyReader)
+	outputHandler.SetAfterReady(afterReady)
 	outputHandler.SetTimeout(timeout)
+	outputHandler.SetOutputLimit(configuration.MaxStdoutBytes, configuration.MaxStderrBytes)
 	outputHandler.SetAfterExitHook(func() {
 		codeReader.Close()
 		codeWriter.Close()
 		os.Remove(bootstrapPath)
 		ReleaseUID(uid)
+		generation.Release()
 	})
 
-	// create a new process
+	// create a new process, python.so is loaded from LIB_PATH before the
+	// bootstrap chroots into the generation
 	cmd := exec.Command(
 		configuration.PythonPath,
 		bootstrapPath,
-		LIB_PATH,
+		generation.Root(),
 	)
 	cmd.Env = []string{
 		// The sandbox child loads a Go c-shared library to install seccomp.
@@ -77,19 +191,8 @@ func (p *PythonRunner) Run(
 		"GODEBUG=decoratemappings=0,containermaxprocs=0,updatemaxprocs=0",
 	}
 	cmd.Dir = LIB_PATH
-	cmd.ExtraFiles = []*os.File{codeReader}
-
-	if configuration.Proxy.Socks5 != "" {
-		cmd.Env = append(cmd.Env, fmt.Sprintf("HTTPS_PROXY=%s", configuration.Proxy.Socks5))
-		cmd.Env = append(cmd.Env, fmt.Sprintf("HTTP_PROXY=%s", configuration.Proxy.Socks5))
-	} else if configuration.Proxy.Https != "" || configuration.Proxy.Http != "" {
-		if configuration.Proxy.Https != "" {
-			cmd.Env = append(cmd.Env, fmt.Sprintf("HTTPS_PROXY=%s", configuration.Proxy.Https))
-		}
-		if configuration.Proxy.Http != "" {
-			cmd.Env = append(cmd.Env, fmt.Sprintf("HTTP_PROXY=%s", configuration.Proxy.Http))
-		}
-	}
+	cmd.ExtraFiles = append([]*os.File{codeReader, readyWriter}, extraFiles...)
+	cmd.Env = append(cmd.Env, proxyEnv(configuration)...)
 
 	if len(configuration.AllowedSyscalls) > 0 {
 		cmd.Env = append(cmd.Env,
@@ -99,21 +202,41 @@ func (p *PythonRunner) Run(
 		)
 	}
 
-	go func() {
-		_, _ = io.WriteString(codeWriter, code)
-		codeWriter.Close()
-	}()
+	// the leaf of the uid, nil without cgroups
+	sandboxCgroup := cgroup.Begin(uid)
+	outputHandler.SetCgroup(sandboxCgroup)
 
 	err = outputHandler.CaptureOutput(ctx, cmd)
+	// the child owns its copy now, EOF on the reader means it exited
+	readyWriter.Close()
 	if err != nil {
+		sandboxCgroup.Finish()
+		readyReader.Close()
 		codeReader.Close()
 		codeWriter.Close()
 		os.Remove(bootstrapPath)
 		ReleaseUID(uid)
-		return nil, err
+		generation.Release()
+		return nil, nil, err
 	}
 
-	return outputHandler.Result(), nil
+	return codeWriter, outputHandler, nil
+}
+
+func proxyEnv(configuration types_config.DifySandboxGlobalConfigurations) []string {
+	env := []string{}
+	if configuration.Proxy.Socks5 != "" {
+		env = append(env, fmt.Sprintf("HTTPS_PROXY=%s", configuration.Proxy.Socks5))
+		env = append(env, fmt.Sprintf("HTTP_PROXY=%s", configuration.Proxy.Socks5))
+	} else if configuration.Proxy.Https != "" || configuration.Proxy.Http != "" {
+		if configuration.Proxy.Https != "" {
+			env = append(env, fmt.Sprintf("HTTPS_PROXY=%s", configuration.Proxy.Https))
+		}
+		if configuration.Proxy.Http != "" {
+			env = append(env, fmt.Sprintf("HTTP_PROXY=%s", configuration.Proxy.Http))
+		}
+	}
+	return env
 }
 
 func buildBootstrap(preload string, options *types.RunnerOptions, uid int) string {
@@ -139,6 +262,12 @@ func buildBootstrap(preload string, options *types.RunnerOptions, uid int) strin
 		)
 	}
 
+	if options.Batch {
+		script = strings.Replace(script, "{{batch}}", "True", 1)
+	} else {
+		script = strings.Replace(script, "{{batch}}", "False", 1)
+	}
+
 	return strings.Replace(
 		script,
 		"{{preload}}",
@@ -22,3 +22,12 @@ func TestBuildBootstrapInjectsPreloadButNotUserCode(t *testing.T) {
 		t.Fatal("bootstrap unexpectedly contains user code")
 	}
 }
+
+func BenchmarkBuildBootstrap(b *testing.B) {
+	preload := strings.Repeat("import json\n", 64)
+	options := &types.RunnerOptions{EnableNetwork: true}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		buildBootstrap(preload, options, 10000+i%1000)
+	}
+}
@@ -0,0 +1,612 @@
+//go:build linux
+
+package python
+
+import (
+	"context"
+	_ "embed"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"log/slog"
+	"net"
+	"os"
+	"os/exec"
+	"strconv"
+	"sync"
+	"syscall"
+	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/core/lib"
+	lib_python "github.com/langgenius/dify-sandbox/internal/core/lib/python"
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
+	python_dependencies "github.com/langgenius/dify-sandbox/internal/core/runner/python/dependencies"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/types"
+	"github.com/langgenius/dify-sandbox/internal/static"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
+)
+
+//go:embed zygote.py
+var zygote_script string
+
+var ErrZygoteExited = errors.New("python zygote exited")
+
+// zygoteForkTimeout bounds the wait for the pid of a forked child, a healthy
+// zygote answers within milliseconds.
+var zygoteForkTimeout = 10 * time.Second
+
+// zygoteReply is a message sent by zygote.py, either the pid of a freshly
+// forked child, a fork error, or the raw wait status and resource usage of a
+// finished child.
+type zygoteReply struct {
+	ID     uint64 `json:"id"`
+	Pid    int    `json:"pid"`
+	Status *int   `json:"status"`
+	Error  string `json:"error"`
+
+	UserTime   float64 `json:"utime"`
+	SystemTime float64 `json:"stime"`
+	// in kilobytes, without the anonymous memory the child inherited from the
+	// zygote
+	MaxRSS int64 `json:"maxrss"`
+}
+
+type zygoteRequest struct {
+	Op  string `json:"op"`
+	ID  uint64 `json:"id"`
+	Uid int    `json:"uid,omitempty"`
+	// the directory the child chroots into
+	Root string `json:"root,omitempty"`
+}
+
+// zygote is a root-owned python interpreter which already imported the
+// dependency set and holds a compiled seccomp program. It forks one child per
+// run, the child chroots, drops privileges, applies the filter and executes
+// the user code read from fd 3.
+type zygote struct {
+	cmd  *exec.Cmd
+	conn *net.UnixConn
+
+	mu       sync.Mutex
+	nextID   uint64
+	forks    int
+	pending  map[uint64]*zygoteChild
+	draining bool
+	dead     bool
+}
+
+type zygoteChild struct {
+	id      uint64
+	zygote  *zygote
+	started chan zygoteReply
+	exited  chan zygoteReply
+}
+
+func startZygote(options *types.RunnerOptions) (*zygote, error) {
+	configuration := static.GetDifySandboxGlobalConfigurations()
+
+	allowed_syscalls, allowed_not_kill_syscalls := lib_python.SeccompSyscalls(
+		configuration.AllowedSyscalls, options.EnableNetwork,
+	)
+	filter, err := lib.ExportSeccompFilter(allowed_syscalls, allowed_not_kill_syscalls)
+	if err != nil {
+		return nil, fmt.Errorf("export seccomp filter: %w", err)
+	}
+
+	preimports := []string{}
+	for _, dependency := range python_dependencies.ListDependencies() {
+		preimports = append(preimports, dependency.Name)
+	}
+	preimportsJson, _ := json.Marshal(preimports)
+
+	fds, err := syscall.Socketpair(syscall.AF_UNIX, syscall.SOCK_SEQPACKET|syscall.SOCK_CLOEXEC, 0)
+	if err != nil {
+		return nil, err
+	}
+	local := os.NewFile(uintptr(fds[0]), "zygote-control")
+	remote := os.NewFile(uintptr(fds[1]), "zygote-control")
+	defer local.Close()
+	defer remote.Close()
+
+	filterReader, filterWriter, err := os.Pipe()
+	if err != nil {
+		return nil, err
+	}
+	defer filterReader.Close()
+	// the filter is far smaller than the pipe buffer
+	_, err = filterWriter.Write(filter)
+	filterWriter.Close()
+	if err != nil {
+		return nil, err
+	}
+
+	cmd := exec.Command(
+		configuration.PythonPath,
+		"-c", zygote_script,
+		LIB_PATH,
+		strconv.Itoa(static.SANDBOX_GROUP_ID),
+		string(preimportsJson),
+	)
+	cmd.Env = proxyEnv(configuration)
+	cmd.Dir = LIB_PATH
+	cmd.Stderr = os.Stderr
+	cmd.ExtraFiles = []*os.File{remote, filterReader}
+	cmd.SysProcAttr = &syscall.SysProcAttr{Pdeathsig: syscall.SIGKILL}
+
+	conn, err := net.FileConn(local)
+	if err != nil {
+		return nil, err
+	}
+
+	if err := cmd.Start(); err != nil {
+		conn.Close()
+		return nil, err
+	}
+
+	z := &zygote{
+		cmd:     cmd,
+		conn:    conn.(*net.UnixConn),
+		pending: map[uint64]*zygoteChild{},
+	}
+	go z.readReplies()
+
+	slog.Info("python zygote started", "pid", cmd.Process.Pid, "enable_network", options.EnableNetwork)
+	return z, nil
+}
+
+func (z *zygote) readReplies() {
+	buf := make([]byte, 4096)
+	for {
+		n, err := z.conn.Read(buf)
+		if err != nil {
+			break
+		}
+
+		var reply zygoteReply
+		if err := json.Unmarshal(buf[:n], &reply); err != nil {
+			slog.Error("invalid python zygote reply", "err", err)
+			continue
+		}
+
+		z.mu.Lock()
+		child, ok := z.pending[reply.ID]
+		if ok && (reply.Status != nil || reply.Error != "") {
+			delete(z.pending, reply.ID)
+		}
+		closeConn := z.draining && len(z.pending) == 0
+		z.mu.Unlock()
+
+		if ok {
+			if reply.Status != nil {
+				child.exited <- reply
+			} else {
+				child.started <- reply
+			}
+		}
+
+		if closeConn {
+			// recycled and drained, EOF lets the zygote exit
+			z.conn.Close()
+		}
+	}
+
+	z.mu.Lock()
+	z.dead = true
+	pending := z.pending
+	z.pending = map[uint64]*zygoteChild{}
+	z.mu.Unlock()
+
+	for _, child := range pending {
+		reply := zygoteReply{ID: child.id, Error: ErrZygoteExited.Error()}
+		select {
+		case child.started <- reply:
+		default:
+		}
+		select {
+		case child.exited <- reply:
+		default:
+		}
+	}
+
+	z.conn.Close()
+	z.cmd.Wait()
+	slog.Info("python zygote exited", "pid", z.cmd.Process.Pid)
+}
+
+func (z *zygote) send(request zygoteRequest, fds ...int) error {
+	data, err := json.Marshal(request)
+	if err != nil {
+		return err
+	}
+
+	var oob []byte
+	if len(fds) > 0 {
+		oob = syscall.UnixRights(fds...)
+	}
+
+	_, _, err = z.conn.WriteMsgUnix(data, oob, nil)
+	return err
+}
+
+// reserve registers a new child on the zygote, it returns nil once the zygote
+// is draining or dead.
+func (z *zygote) reserve(maxForks int) *zygoteChild {
+	z.mu.Lock()
+	defer z.mu.Unlock()
+
+	if z.dead || z.draining {
+		return nil
+	}
+
+	z.nextID++
+	z.forks++
+	if z.forks >= maxForks {
+		z.draining = true
+	}
+
+	child := &zygoteChild{
+		id:      z.nextID,
+		zygote:  z,
+		started: make(chan zygoteReply, 1),
+		exited:  make(chan zygoteReply, 1),
+	}
+	z.pending[child.id] = child
+	return child
+}
+
+func (z *zygote) cancel(child *zygoteChild) {
+	z.mu.Lock()
+	delete(z.pending, child.id)
+	closeConn := z.draining && len(z.pending) == 0
+	z.mu.Unlock()
+
+	if closeConn {
+		z.conn.Close()
+	}
+}
+
+func (z *zygote) usable() bool {
+	z.mu.Lock()
+	defer z.mu.Unlock()
+	return !z.dead && !z.draining
+}
+
+// abandon kills a zygote which cannot be relied on anymore. Its children set
+// PDEATHSIG and die with it, readReplies reports them as exited and the pool
+// starts a replacement on the next reserve.
+func (z *zygote) abandon(reason error) {
+	z.mu.Lock()
+	z.draining = true
+	z.mu.Unlock()
+
+	slog.Warn("recycling python zygote", "pid", z.cmd.Process.Pid, "err", reason)
+	z.cmd.Process.Kill()
+}
+
+// drain stops forking, the zygote exits once its children exited.
+func (z *zygote) drain() {
+	z.mu.Lock()
+	closeConn := !z.draining && len(z.pending) == 0
+	z.draining = true
+	z.mu.Unlock()
+
+	if closeConn {
+		z.conn.Close()
+	}
+}
+
+// fork asks the zygote for a new child running as uid in root with the given
+// fds as stdout, stderr, fd 3 and fd 4. With a cgroupProcs file the child
+// moves itself into that cgroup before anything else. A zygote which does not
+// answer within zygoteForkTimeout, or before ctx is done, is abandoned since
+// the child may still be forked later.
+func (c *zygoteChild) fork(ctx context.Context, uid int, root string, stdout *os.File, stderr *os.File, code *os.File, ready *os.File, cgroupProcs *os.File) error {
+	fds := []int{int(stdout.Fd()), int(stderr.Fd()), int(code.Fd()), int(ready.Fd())}
+	if cgroupProcs != nil {
+		fds = append(fds, int(cgroupProcs.Fd()))
+	}
+
+	err := c.zygote.send(zygoteRequest{
+		Op:   "fork",
+		ID:   c.id,
+		Uid:  uid,
+		Root: root,
+	}, fds...)
+	if err != nil {
+		c.zygote.cancel(c)
+		return err
+	}
+
+	timer := time.NewTimer(zygoteForkTimeout)
+	defer timer.Stop()
+
+	select {
+	case reply := <-c.started:
+		if reply.Error != "" {
+			return fmt.Errorf("fork python zygote: %s", reply.Error)
+		}
+		return nil
+	case <-ctx.Done():
+		err = ctx.Err()
+	case <-timer.C:
+		err = errors.New("no answer to the fork request")
+	}
+
+	c.zygote.abandon(err)
+	return fmt.Errorf("fork python zygote: %w", err)
+}
+
+func (c *zygoteChild) Kill() error {
+	return c.zygote.send(zygoteRequest{
+		Op: "kill",
+		ID: c.id,
+	})
+}
+
+func (c *zygoteChild) Wait() (*runner.ProcessStatus, error) {
+	reply := <-c.exited
+	if reply.Error != "" {
+		return nil, errors.New(reply.Error)
+	}
+
+	status := waitStatusToProcessStatus(syscall.WaitStatus(*reply.Status))
+	status.UserTime = time.Duration(reply.UserTime * float64(time.Second))
+	status.SystemTime = time.Duration(reply.SystemTime * float64(time.Second))
+	status.MaxRSS = reply.MaxRSS * 1024
+	return status, nil
+}
+
+// waitStatusToProcessStatus mirrors os.ProcessState for a status reported by
+// the zygote, which is the real parent of the child.
+func waitStatusToProcessStatus(status syscall.WaitStatus) *runner.ProcessStatus {
+	switch {
+	case status.Exited():
+		return &runner.ProcessStatus{
+			ExitCode: status.ExitStatus(),
+			Status:   "exit status " + strconv.Itoa(status.ExitStatus()),
+		}
+	case status.Signaled():
+		return &runner.ProcessStatus{
+			ExitCode: -1,
+			Status:   "signal: " + status.Signal().String(),
+		}
+	default:
+		return &runner.ProcessStatus{
+			ExitCode: -1,
+			Status:   "unknown status " + strconv.Itoa(int(status)),
+		}
+	}
+}
+
+type zygotePool struct {
+	mu      sync.Mutex
+	options types.RunnerOptions
+	zygotes []*zygote
+	next    int
+	// zygotes started in the background, not yet in zygotes
+	starting int
+}
+
+var (
+	zygotePools     = map[bool]*zygotePool{}
+	zygotePoolsLock sync.Mutex
+)
+
+func getZygotePool(options *types.RunnerOptions) *zygotePool {
+	zygotePoolsLock.Lock()
+	defer zygotePoolsLock.Unlock()
+
+	pool, ok := zygotePools[options.EnableNetwork]
+	if !ok {
+		pool = &zygotePool{options: *options}
+		zygotePools[options.EnableNetwork] = pool
+	}
+	return pool
+}
+
+// StartZygotes pre-forks the zygotes of both network modes when the pool is
+// enabled, so that the first runs do not pay for interpreter startup and the
+// pre-imports.
+func StartZygotes() {
+	if !static.GetDifySandboxGlobalConfigurations().PythonZygote.Enabled {
+		return
+	}
+
+	for _, enableNetwork := range []bool{false, true} {
+		getZygotePool(&types.RunnerOptions{EnableNetwork: enableNetwork}).fill()
+	}
+}
+
+// drainZygotes recycles all zygotes and starts their replacements.
+func drainZygotes() {
+	zygotePoolsLock.Lock()
+	pools := make([]*zygotePool, 0, len(zygotePools))
+	for _, pool := range zygotePools {
+		pools = append(pools, pool)
+	}
+	zygotePoolsLock.Unlock()
+
+	for _, pool := range pools {
+		pool.mu.Lock()
+		for _, z := range pool.zygotes {
+			z.drain()
+		}
+		pool.mu.Unlock()
+		pool.fill()
+	}
+}
+
+// prune drops recycled and dead zygotes, p.mu must be held.
+func (p *zygotePool) prune() {
+	zygotes := p.zygotes[:0]
+	for _, z := range p.zygotes {
+		if z.usable() {
+			zygotes = append(zygotes, z)
+		}
+	}
+	p.zygotes = zygotes
+}
+
+// fill starts the zygotes missing from the pool in the background.
+func (p *zygotePool) fill() {
+	configuration := static.GetDifySandboxGlobalConfigurations()
+
+	p.mu.Lock()
+	p.prune()
+	missing := configuration.PythonZygote.PoolSize - len(p.zygotes) - p.starting
+	if missing < 0 {
+		missing = 0
+	}
+	p.starting += missing
+	p.mu.Unlock()
+
+	for i := 0; i < missing; i++ {
+		go func() {
+			z, err := startZygote(&p.options)
+
+			p.mu.Lock()
+			defer p.mu.Unlock()
+			p.starting--
+			if err != nil {
+				slog.Error("failed to start python zygote", "err", err)
+				return
+			}
+			p.zygotes = append(p.zygotes, z)
+		}()
+	}
+}
+
+// reserve picks a zygote round robin and refills the pool in the
+// background. Only when no zygote is usable the run starts one itself,
+// outside of the lock so that other runs are not held up.
+func (p *zygotePool) reserve() (*zygoteChild, error) {
+	configuration := static.GetDifySandboxGlobalConfigurations()
+	maxForks := configuration.PythonZygote.MaxForks
+
+	p.mu.Lock()
+	p.prune()
+	var child *zygoteChild
+	for i := 0; i < len(p.zygotes) && child == nil; i++ {
+		z := p.zygotes[p.next%len(p.zygotes)]
+		p.next++
+		child = z.reserve(maxForks)
+	}
+	p.mu.Unlock()
+
+	p.fill()
+	if child != nil {
+		return child, nil
+	}
+
+	z, err := startZygote(&p.options)
+	if err != nil {
+		return nil, fmt.Errorf("start python zygote: %w", err)
+	}
+	child = z.reserve(maxForks)
+
+	p.mu.Lock()
+	p.zygotes = append(p.zygotes, z)
+	p.mu.Unlock()
+
+	if child == nil {
+		return nil, ErrZygoteExited
+	}
+	return child, nil
+}
+
+func (p *PythonRunner) runInZygote(
+	ctx context.Context,
+	code string,
+	timeout time.Duration,
+	options *types.RunnerOptions,
+) (*runner.OutputCaptureResult, error) {
+	configuration := static.GetDifySandboxGlobalConfigurations()
+
+	if !sandboxGenerations.Ready() {
+		return nil, ErrSandboxEnvNotReady
+	}
+
+	uidWaitStart := time.Now()
+	uid, err := AcquireUID(ctx)
+	if err != nil {
+		return nil, fmt.Errorf("no available sandbox UID: %w", err)
+	}
+	metrics.ObservePhase(metrics.LanguagePython3, metrics.PhaseUIDWait, time.Since(uidWaitStart))
+
+	// runs with a preload never reach the zygote
+	artifact, afterReady := getCodeCache().Lookup(code, "")
+
+	prepareStart := time.Now()
+	child, err := getZygotePool(options).reserve()
+	if err != nil {
+		ReleaseUID(uid)
+		return nil, err
+	}
+	metrics.ObservePhase(metrics.LanguagePython3, metrics.PhasePrepare, time.Since(prepareStart))
+
+	pipes := make([]*os.File, 0, 8)
+	closePipes := func() {
+		for _, pipe := range pipes {
+			pipe.Close()
+		}
+	}
+	for i := 0; i < 4; i++ {
+		reader, writer, err := os.Pipe()
+		if err != nil {
+			closePipes()
+			child.zygote.cancel(child)
+			ReleaseUID(uid)
+			return nil, err
+		}
+		pipes = append(pipes, reader, writer)
+	}
+	stdoutReader, stdoutWriter := pipes[0], pipes[1]
+	stderrReader, stderrWriter := pipes[2], pipes[3]
+	codeReader, codeWriter := pipes[4], pipes[5]
+	readyReader, readyWriter := pipes[6], pipes[7]
+
+	// the leaf of the uid, nil without cgroups
+	sandboxCgroup := cgroup.Begin(uid)
+	// the run keeps its environment generation even if a sync replaces it
+	generation := sandboxGenerations.Acquire()
+
+	startedAt := time.Now()
+	err = child.fork(ctx, uid, generation.Root(), stdoutWriter, stderrWriter, codeReader, readyWriter, sandboxCgroup.ProcsFile())
+	// the child owns its copies now, EOF on the readers means it exited
+	stdoutWriter.Close()
+	stderrWriter.Close()
+	codeReader.Close()
+	readyWriter.Close()
+	if err != nil {
+		stdoutReader.Close()
+		stderrReader.Close()
+		codeWriter.Close()
+		readyReader.Close()
+		sandboxCgroup.Finish()
+		ReleaseUID(uid)
+		generation.Release()
+		return nil, err
+	}
+	metrics.ObservePhase(metrics.LanguagePython3, metrics.PhaseStart, time.Since(startedAt))
+
+	go func() {
+		_ = runner.WriteCode(codeWriter, artifact, code)
+		codeWriter.Close()
+	}()
+
+	outputHandler := runner.NewOutputCaptureRunner()
+	outputHandler.SetLanguage(metrics.LanguagePython3)
+	outputHandler.SetSandboxReady(readyReader)
+	outputHandler.SetAfterReady(afterReady)
+	outputHandler.SetTimeout(timeout)
+	outputHandler.SetOutputLimit(configuration.MaxStdoutBytes, configuration.MaxStderrBytes)
+	outputHandler.SetCgroup(sandboxCgroup)
+	outputHandler.SetAfterExitHook(func() {
+		ReleaseUID(uid)
+		generation.Release()
+	})
+	outputHandler.CaptureProcessOutput(ctx, child, stdoutReader, stderrReader)
+
+	return outputHandler.Result(), nil
+}
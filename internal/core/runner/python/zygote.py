@@ -0,0 +1,286 @@
+import builtins
+import ctypes
+import importlib.metadata
+import importlib.util
+import json
+import marshal
+import os
+import select
+import signal
+import socket
+import sys
+import traceback
+
+# The zygote runs as root outside of the chroot. It never loads python.so:
+# the Go runtime inside it does not survive fork, so the seccomp program is
+# compiled by the server and installed here through prctl.
+
+PR_SET_PDEATHSIG = 1
+PR_SET_SECCOMP = 22
+PR_SET_NO_NEW_PRIVS = 38
+SECCOMP_MODE_FILTER = 2
+
+
+class SockFilter(ctypes.Structure):
+    _fields_ = [
+        ("code", ctypes.c_uint16),
+        ("jt", ctypes.c_uint8),
+        ("jf", ctypes.c_uint8),
+        ("k", ctypes.c_uint32),
+    ]
+
+
+class SockFprog(ctypes.Structure):
+    _fields_ = [
+        ("len", ctypes.c_ushort),
+        ("filter", ctypes.POINTER(SockFilter)),
+    ]
+
+
+libc = ctypes.CDLL(None, use_errno=True)
+libc.prctl.argtypes = [ctypes.c_int, ctypes.c_ulong, ctypes.c_ulong, ctypes.c_ulong, ctypes.c_ulong]
+libc.prctl.restype = ctypes.c_int
+
+running_path = sys.argv[1]
+gid = int(sys.argv[2])
+preimports = json.loads(sys.argv[3])
+
+# fd 3 is the control socket, fd 4 carries the compiled seccomp program
+control = socket.socket(fileno=3)
+with os.fdopen(4, "rb") as program_fd:
+    program = program_fd.read()
+
+filters = (SockFilter * (len(program) // 8)).from_buffer_copy(program)
+fprog = SockFprog(len(filters), filters)
+
+
+# preimports are distribution names as listed by the dependencies package,
+# python-dateutil installs dateutil and beautifulsoup4 installs bs4
+def module_names(distribution):
+    try:
+        dist = importlib.metadata.distribution(distribution)
+    except importlib.metadata.PackageNotFoundError:
+        return [distribution.replace("-", "_").lower()]
+
+    top_level = dist.read_text("top_level.txt")
+    if top_level:
+        names = top_level.split()
+    else:
+        names = set()
+        for file in dist.files or []:
+            if len(file.parts) == 2 and file.parts[1] == "__init__.py":
+                names.add(file.parts[0])
+            elif len(file.parts) == 1 and file.parts[0].endswith(".py"):
+                names.add(file.parts[0][:-3])
+    names = sorted(name for name in names if not name.startswith("_"))
+    return names or [distribution.replace("-", "_").lower()]
+
+
+for distribution in preimports:
+    for name in module_names(distribution):
+        try:
+            __import__(name)
+        except Exception as e:
+            if name != distribution:
+                name = "%s of %s" % (name, distribution)
+            sys.stderr.write("python zygote: failed to preimport %s: %r\n" % (name, e))
+
+
+def prctl(option, arg2, arg3=0):
+    if libc.prctl(option, arg2, arg3, 0, 0) != 0:
+        errno = ctypes.get_errno()
+        raise OSError(errno, os.strerror(errno))
+
+
+def exit_code(e):
+    if e.code is None:
+        return 0
+    if isinstance(e.code, int):
+        return e.code
+    sys.stderr.write("%s\n" % e.code)
+    return 1
+
+
+# fd 3 carries the cached code object as one frame followed by the source.
+# A used one is confirmed with an empty frame on fd 4, otherwise the source is
+# compiled and the marshalled code object is reported there. fd 4 is closed
+# before user code runs.
+def load_code(code_fd):
+    header = code_fd.readline()
+    artifact = code_fd.read(int(header)) if header else b""
+    code = code_fd.read().decode("utf-8")
+
+    magic = importlib.util.MAGIC_NUMBER
+    if artifact and artifact.startswith(magic):
+        try:
+            code_object = marshal.loads(artifact[len(magic):])
+        except Exception:
+            pass
+        else:
+            try:
+                os.write(4, b"0\n")
+            except OSError:
+                pass
+            return code_object
+
+    code_object = compile(code, "<fd3>", "exec")
+    try:
+        artifact = magic + marshal.dumps(code_object)
+        os.write(4, b"%d\n" % len(artifact))
+        view = memoryview(artifact)
+        while view:
+            view = view[os.write(4, view):]
+    except (OSError, ValueError):
+        pass
+    return code_object
+
+
+def run_child(uid, root, fds):
+    signal.set_wakeup_fd(-1)
+    signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+
+    stdout_fd, stderr_fd, code_fd, ready_fd = fds[:4]
+    if len(fds) == 5:
+        # join the cgroup of this run, memory charged so far stays with the
+        # zygote. Without it the run is only limited by its timeout.
+        try:
+            os.write(fds[4], b"0")
+        except OSError:
+            pass
+        os.close(fds[4])
+
+    control.detach()
+    os.dup2(stdout_fd, 1)
+    os.dup2(stderr_fd, 2)
+    os.dup2(code_fd, 3)
+    os.dup2(ready_fd, 4)
+    os.closerange(5, 65536)
+
+    prctl(PR_SET_PDEATHSIG, signal.SIGKILL)
+    os.chroot(root)
+    os.chdir("/")
+    prctl(PR_SET_NO_NEW_PRIVS, 1)
+    prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, ctypes.addressof(fprog))
+    os.setgroups([])
+    os.setgid(gid)
+    os.setuid(uid)
+
+    # tell the server that the sandbox is in place
+    os.write(4, b"\0")
+
+    try:
+        with os.fdopen(3, "rb") as code_fd:
+            code_object = load_code(code_fd)
+    finally:
+        os.close(4)
+
+    exec(code_object, {"__name__": "__main__", "__builtins__": builtins})
+
+
+def child_main(uid, root, fds):
+    status = 0
+    try:
+        run_child(uid, root, fds)
+    except SystemExit as e:
+        status = exit_code(e)
+    except BaseException:
+        sys.stderr.write("".join(traceback.format_exception(*sys.exc_info())))
+        status = -1
+
+    try:
+        sys.stdout.flush()
+        sys.stderr.flush()
+    finally:
+        os._exit(status & 0xFF)
+
+
+# the resident anonymous memory of the zygote in kilobytes. fork copies the
+# page table entries of anonymous memory, so a child starts out with that much
+# resident, its reported maxrss is reduced by it to cover what the run added.
+# File backed pages are only faulted in by the child when it uses them.
+def resident_kb():
+    try:
+        with open("/proc/self/status") as status:
+            for line in status:
+                if line.startswith("RssAnon:"):
+                    return int(line.split()[1])
+    except (OSError, ValueError, IndexError):
+        pass
+    return 0
+
+
+def reply(message):
+    control.send(json.dumps(message).encode("utf-8"))
+
+
+def main():
+    children = {}
+
+    wakeup_r, wakeup_w = os.pipe()
+    os.set_blocking(wakeup_r, False)
+    os.set_blocking(wakeup_w, False)
+    signal.set_wakeup_fd(wakeup_w)
+    signal.signal(signal.SIGCHLD, lambda signum, frame: None)
+
+    closing = False
+    while not closing or children:
+        watched = [wakeup_r] if closing else [wakeup_r, control]
+        readable, _, _ = select.select(watched, [], [])
+
+        if wakeup_r in readable:
+            try:
+                while os.read(wakeup_r, 4096):
+                    pass
+            except BlockingIOError:
+                pass
+
+            while children:
+                pid, status, rusage = os.wait4(-1, os.WNOHANG)
+                if pid == 0:
+                    break
+                child = children.pop(pid, None)
+                if child is not None:
+                    request_id, baseline = child
+                    reply({
+                        "id": request_id,
+                        "status": status,
+                        "utime": rusage.ru_utime,
+                        "stime": rusage.ru_stime,
+                        "maxrss": max(rusage.ru_maxrss - baseline, 0),
+                    })
+
+        if control in readable:
+            message, fds, _, _ = socket.recv_fds(control, 4096, 5)
+            if not message:
+                closing = True
+                for fd in fds:
+                    os.close(fd)
+                continue
+
+            request = json.loads(message)
+            if request["op"] == "fork":
+                try:
+                    if len(fds) not in (4, 5):
+                        raise ValueError("expected 4 or 5 fds, got %d" % len(fds))
+                    baseline = resident_kb()
+                    pid = os.fork()
+                except Exception as e:
+                    reply({"id": request["id"], "error": str(e)})
+                    pid = -1
+
+                if pid == 0:
+                    child_main(request["uid"], request.get("root") or running_path, fds)
+
+                for fd in fds:
+                    os.close(fd)
+
+                if pid > 0:
+                    children[pid] = (request["id"], baseline)
+                    reply({"id": request["id"], "pid": pid})
+            elif request["op"] == "kill":
+                for pid, (request_id, _) in children.items():
+                    if request_id == request["id"]:
+                        os.kill(pid, signal.SIGKILL)
+
+
+main()
@@ -0,0 +1,308 @@
+//go:build linux
+
+package python
+
+import (
+	"bufio"
+	"context"
+	"io"
+	"net"
+	"os"
+	"os/exec"
+	"path"
+	"strconv"
+	"strings"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/types"
+	"github.com/langgenius/dify-sandbox/internal/static"
+)
+
+func TestWaitStatusToProcessStatusReportsExitCode(t *testing.T) {
+	status := waitStatusToProcessStatus(syscall.WaitStatus(7 << 8))
+
+	if status.ExitCode != 7 {
+		t.Fatalf("expected exit code 7, got %d", status.ExitCode)
+	}
+
+	if status.Status != "exit status 7" {
+		t.Fatalf("unexpected status %q", status.Status)
+	}
+}
+
+func TestWaitStatusToProcessStatusReportsSeccompKill(t *testing.T) {
+	status := waitStatusToProcessStatus(syscall.WaitStatus(syscall.SIGSYS))
+
+	if status.ExitCode != -1 {
+		t.Fatalf("expected exit code -1 for a signaled child, got %d", status.ExitCode)
+	}
+
+	if status.Status != "signal: bad system call" {
+		t.Fatalf("expected the same status text as os.ProcessState, got %q", status.Status)
+	}
+}
+
+// startTestZygote starts a zygote with the python3 on PATH, the zygote forks
+// and chroots, so only root can run it.
+func startTestZygote(t *testing.T) *zygote {
+	t.Helper()
+	if os.Geteuid() != 0 {
+		t.Skip("the zygote chroots its children, run as root")
+	}
+	python, err := exec.LookPath("python3")
+	if err != nil {
+		t.Skip("python3 not available")
+	}
+
+	config := path.Join(t.TempDir(), "config.yaml")
+	if err := os.WriteFile(config, []byte("max_workers: 1\n"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	t.Setenv("PYTHON_PATH", python)
+	if err := static.InitConfig(config); err != nil {
+		t.Fatal(err)
+	}
+
+	z, err := startZygote(&types.RunnerOptions{})
+	if err != nil {
+		t.Fatalf("start zygote: %v", err)
+	}
+	t.Cleanup(z.drain)
+	return z
+}
+
+type testZygoteRun struct {
+	child  *zygoteChild
+	stdout *os.File
+	code   *os.File
+	ready  *os.File
+}
+
+func forkTestChild(t *testing.T, z *zygote) *testZygoteRun {
+	t.Helper()
+	child := z.reserve(10)
+	if child == nil {
+		t.Fatal("expected a fresh zygote to accept a child")
+	}
+
+	pipes := make([]*os.File, 0, 8)
+	for i := 0; i < 4; i++ {
+		reader, writer, err := os.Pipe()
+		if err != nil {
+			t.Fatal(err)
+		}
+		pipes = append(pipes, reader, writer)
+	}
+
+	// the child only sees its root, an empty one is enough for builtins
+	err := child.fork(context.Background(), 65534, t.TempDir(), pipes[1], pipes[3], pipes[4], pipes[7], nil)
+	t.Cleanup(func() { pipes[2].Close() })
+	pipes[1].Close()
+	pipes[3].Close()
+	pipes[4].Close()
+	pipes[7].Close()
+	if err != nil {
+		t.Fatalf("fork: %v", err)
+	}
+
+	return &testZygoteRun{child: child, stdout: pipes[0], code: pipes[5], ready: pipes[6]}
+}
+
+func TestZygoteForksSandboxedChild(t *testing.T) {
+	z := startTestZygote(t)
+	run := forkTestChild(t, z)
+	defer run.stdout.Close()
+	defer run.ready.Close()
+
+	ready := make([]byte, 1)
+	if _, err := io.ReadFull(run.ready, ready); err != nil || ready[0] != 0 {
+		t.Fatalf("expected the sandbox ready byte, got %v, %v", ready, err)
+	}
+
+	code := "import os\nprint(os.getuid(), os.listdir('/'))\nraise SystemExit(3)\n"
+	if err := runner.WriteCode(run.code, nil, code); err != nil {
+		t.Fatal(err)
+	}
+	run.code.Close()
+
+	// a miss reports the compiled artifact before user code runs
+	artifact, err := runner.ReadBatchFrame(bufio.NewReader(run.ready), 1<<20)
+	if err != nil || len(artifact) == 0 {
+		t.Fatalf("expected the compiled artifact, got %d bytes, %v", len(artifact), err)
+	}
+
+	stdout, err := io.ReadAll(run.stdout)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if string(stdout) != "65534 []\n" {
+		t.Fatalf("expected the child to run as the given uid in its root, got %q", stdout)
+	}
+
+	status, err := run.child.Wait()
+	if err != nil {
+		t.Fatalf("wait: %v", err)
+	}
+	if status.ExitCode != 3 {
+		t.Fatalf("expected exit code 3, got %+v", status)
+	}
+}
+
+func TestZygoteChildConfirmsCachedArtifact(t *testing.T) {
+	z := startTestZygote(t)
+	code := "print(6 * 7)\n"
+
+	var artifact []byte
+	for i, want := range []string{"compiled", "confirmed"} {
+		run := forkTestChild(t, z)
+		if err := runner.WriteCode(run.code, artifact, code); err != nil {
+			t.Fatal(err)
+		}
+		run.code.Close()
+
+		ready := bufio.NewReader(run.ready)
+		if b, err := ready.ReadByte(); err != nil || b != 0 {
+			t.Fatalf("expected the sandbox ready byte, got %v, %v", b, err)
+		}
+		reported, err := runner.ReadBatchFrame(ready, 1<<20)
+		if err != nil {
+			t.Fatalf("run %d: expected a frame, got %v", i, err)
+		}
+		if want == "compiled" && len(reported) == 0 {
+			t.Fatalf("expected the compiled artifact on a miss")
+		}
+		if want == "confirmed" && len(reported) != 0 {
+			t.Fatalf("expected an empty frame for a used artifact, got %d bytes", len(reported))
+		}
+		artifact = reported
+
+		stdout, _ := io.ReadAll(run.stdout)
+		if string(stdout) != "42\n" {
+			t.Fatalf("run %d: unexpected stdout %q", i, stdout)
+		}
+		run.stdout.Close()
+		run.ready.Close()
+		run.child.Wait()
+	}
+}
+
+func TestZygoteKillsChild(t *testing.T) {
+	z := startTestZygote(t)
+	run := forkTestChild(t, z)
+	defer run.stdout.Close()
+	defer run.ready.Close()
+
+	if err := runner.WriteCode(run.code, nil, "import time\ntime.sleep(60)\n"); err != nil {
+		t.Fatal(err)
+	}
+	run.code.Close()
+
+	if err := run.child.Kill(); err != nil {
+		t.Fatalf("kill: %v", err)
+	}
+	status, err := run.child.Wait()
+	if err != nil {
+		t.Fatalf("wait: %v", err)
+	}
+	if status.Status != "signal: killed" {
+		t.Fatalf("expected the child to be killed, got %+v", status)
+	}
+}
+
+func TestZygoteForkAbandonsUnresponsiveZygote(t *testing.T) {
+	fds, err := syscall.Socketpair(syscall.AF_UNIX, syscall.SOCK_SEQPACKET|syscall.SOCK_CLOEXEC, 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	local := os.NewFile(uintptr(fds[0]), "zygote-control")
+	remote := os.NewFile(uintptr(fds[1]), "zygote-control")
+	defer local.Close()
+
+	// holds the other end of the socket and never answers
+	cmd := exec.Command("/bin/sleep", "60")
+	cmd.ExtraFiles = []*os.File{remote}
+	if err := cmd.Start(); err != nil {
+		t.Fatal(err)
+	}
+	remote.Close()
+
+	conn, err := net.FileConn(local)
+	if err != nil {
+		t.Fatal(err)
+	}
+	z := &zygote{cmd: cmd, conn: conn.(*net.UnixConn), pending: map[uint64]*zygoteChild{}}
+	go z.readReplies()
+
+	timeout := zygoteForkTimeout
+	zygoteForkTimeout = 50 * time.Millisecond
+	defer func() { zygoteForkTimeout = timeout }()
+
+	reader, writer, err := os.Pipe()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reader.Close()
+	defer writer.Close()
+
+	child := z.reserve(10)
+	start := time.Now()
+	err = child.fork(context.Background(), 65534, t.TempDir(), writer, writer, reader, writer, nil)
+	if err == nil {
+		t.Fatal("expected the fork to fail without an answer")
+	}
+	if time.Since(start) > 5*time.Second {
+		t.Fatalf("expected the fork to give up after its timeout, took %v", time.Since(start))
+	}
+	if z.usable() {
+		t.Fatal("expected the zygote to be recycled")
+	}
+
+	exited := make(chan struct{})
+	go func() {
+		child.Wait()
+		close(exited)
+	}()
+	select {
+	case <-exited:
+	case <-time.After(5 * time.Second):
+		t.Fatal("expected the zygote to be killed")
+	}
+}
+
+func TestZygoteChildMaxRSSExcludesZygote(t *testing.T) {
+	z := startTestZygote(t)
+
+	runChild := func(code string) *runner.ProcessStatus {
+		run := forkTestChild(t, z)
+		defer run.stdout.Close()
+		defer run.ready.Close()
+		if err := runner.WriteCode(run.code, nil, code); err != nil {
+			t.Fatal(err)
+		}
+		run.code.Close()
+		io.Copy(io.Discard, run.stdout)
+
+		status, err := run.child.Wait()
+		if err != nil {
+			t.Fatalf("wait: %v", err)
+		}
+		return status
+	}
+
+	// the zygote is up and idle once it answered a run
+	runChild("pass\n")
+	statm, err := os.ReadFile(path.Join("/proc", strconv.Itoa(z.cmd.Process.Pid), "statm"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	pages, _ := strconv.Atoi(strings.Fields(string(statm))[1])
+	zygoteRSS := int64(pages * os.Getpagesize())
+
+	status := runChild("data = bytearray(32 << 20)\n")
+	if status.MaxRSS < 32<<20 || status.MaxRSS >= 32<<20+zygoteRSS {
+		t.Fatalf("expected the 32MiB of the run without the %d bytes of the zygote, got %d", zygoteRSS, status.MaxRSS)
+	}
+}
@@ -0,0 +1,225 @@
+package runner
+
+import (
+	"errors"
+	"fmt"
+	"io"
+	"os"
+	"path"
+	"sort"
+	"sync"
+
+	"github.com/google/uuid"
+)
+
+// SandboxRootfs is a sandbox root shared by all runs of a runner. It mirrors
+// the required paths as a hardlink farm, falling back to a copy when a path
+// lives on another filesystem. Runs never write into the shared tree, each
+// one only gets a private directory for its own files.
+//
+// The root is synced against a manifest of its sources like
+// SandboxGenerations does, but in place: once built it is never removed while
+// the process lives, changed files are replaced by a rename so that runs
+// chrooted into it never see a missing file.
+type SandboxRootfs struct {
+	root string
+
+	lock sync.Mutex
+	// whatever a previous server left behind was removed
+	built bool
+	// the sources the root mirrors, nil until the first complete sync. A
+	// failed sync keeps the previous one, runs still use the root.
+	manifest manifest
+}
+
+func NewSandboxRootfs(root string) *SandboxRootfs {
+	return &SandboxRootfs{root: root}
+}
+
+func (r *SandboxRootfs) Root() string {
+	return r.root
+}
+
+// Ensure syncs the rootfs with paths unless it was already synced, it is
+// cheap enough for every run. Sources changed after the last sync are only
+// picked up by Sync.
+func (r *SandboxRootfs) Ensure(paths []string) error {
+	r.lock.Lock()
+	defer r.lock.Unlock()
+
+	if r.manifest != nil {
+		if _, err := os.Stat(r.root); err == nil {
+			return nil
+		}
+	}
+
+	return r.sync(paths)
+}
+
+// Refresh updates the files among paths whose source changed since the last
+// sync, e.g. /etc/resolv.conf which the container runtime rewrites while the
+// server runs. It only stats paths, which makes it cheap enough for every
+// run. Paths the rootfs does not hold yet are left to Sync.
+func (r *SandboxRootfs) Refresh(paths []string) error {
+	scanned, err := scanPaths(paths)
+	if err != nil {
+		return err
+	}
+
+	r.lock.Lock()
+	defer r.lock.Unlock()
+
+	for key, entry := range scanned {
+		old, ok := r.manifest[key]
+		if !ok || entry.Dir || old.Dir || old.unchanged(entry) {
+			continue
+		}
+		if err := replaceEntry(entry, path.Join(r.root, key)); err != nil {
+			return err
+		}
+		r.manifest[key] = entry
+	}
+	return nil
+}
+
+// Sync scans paths and updates the entries of the rootfs whose source
+// changed by device, inode, size, mtime or mode. Paths which do not exist are
+// skipped.
+func (r *SandboxRootfs) Sync(paths []string) error {
+	r.lock.Lock()
+	defer r.lock.Unlock()
+
+	return r.sync(paths)
+}
+
+func (r *SandboxRootfs) sync(paths []string) error {
+	scanned, err := scanPaths(paths)
+	if err != nil {
+		return err
+	}
+
+	if !r.built {
+		// no run uses a root this process did not build, drop whatever a
+		// previous server left behind
+		if err := os.RemoveAll(r.root); err != nil {
+			return err
+		}
+		r.built = true
+	}
+
+	previous := r.manifest
+	if _, err := os.Stat(r.root); previous == nil || err != nil {
+		// entries of a failed first sync are replaced like changed ones
+		previous = manifest{}
+	} else if previous.equal(scanned) {
+		return nil
+	}
+
+	// parents before children
+	keys := make([]string, 0, len(scanned))
+	for key := range scanned {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+
+	for _, key := range keys {
+		entry := scanned[key]
+		dst := path.Join(r.root, key)
+
+		old, ok := previous[key]
+		if ok && old.Dir != entry.Dir {
+			if err := os.RemoveAll(dst); err != nil {
+				return err
+			}
+			ok = false
+		}
+
+		if entry.Dir {
+			if err := os.MkdirAll(dst, 0755); err != nil {
+				return err
+			}
+			continue
+		}
+		if ok && old.unchanged(entry) {
+			continue
+		}
+		if err := replaceEntry(entry, dst); err != nil {
+			return err
+		}
+	}
+
+	// children before parents
+	removed := []string{}
+	for key := range previous {
+		if _, ok := scanned[key]; !ok {
+			removed = append(removed, key)
+		}
+	}
+	sort.Sort(sort.Reverse(sort.StringSlice(removed)))
+	for _, key := range removed {
+		if err := os.RemoveAll(path.Join(r.root, key)); err != nil {
+			return err
+		}
+	}
+
+	r.manifest = scanned
+	return nil
+}
+
+// replaceEntry creates entry next to dst and renames it over dst.
+func replaceEntry(entry manifestEntry, dst string) error {
+	tmp := dst + ".sync"
+	if err := os.RemoveAll(tmp); err != nil {
+		return err
+	}
+
+	if entry.Symlink != "" {
+		if err := os.Symlink(entry.Symlink, tmp); err != nil {
+			return err
+		}
+	} else if err := os.Link(entry.Source, tmp); err != nil {
+		if err := copyFile(entry.Source, tmp); err != nil {
+			return fmt.Errorf("copy %s: %w", entry.Source, err)
+		}
+	}
+
+	return os.Rename(tmp, dst)
+}
+
+// CreateRunDir creates a private directory for one run under dir, which is
+// a path inside the sandbox. The caller removes it once the run exited.
+func (r *SandboxRootfs) CreateRunDir(dir string) (string, error) {
+	uuid, err := uuid.NewRandom()
+	if err != nil {
+		return "", err
+	}
+
+	runDir := path.Join(r.root, dir, "sandbox-"+uuid.String())
+	err = os.Mkdir(runDir, 0700)
+	if err != nil {
+		return "", err
+	}
+
+	return runDir, nil
+}
+
+func copyFile(src string, dst string) error {
+	info, err := os.Stat(src)
+	if err != nil {
+		return err
+	}
+
+	source, err := os.Open(src)
+	if err != nil {
+		return err
+	}
+	defer source.Close()
+
+	target, err := os.OpenFile(dst, os.O_CREATE|os.O_WRONLY|os.O_TRUNC, info.Mode().Perm())
+	if err != nil {
+		return err
+	}
+
+	_, err = io.Copy(target, source)
+	return errors.Join(err, target.Close())
+}
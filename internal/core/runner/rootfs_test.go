@@ -0,0 +1,212 @@
+package runner
+
+import (
+	"os"
+	"path"
+	"syscall"
+	"testing"
+)
+
+func TestSandboxRootfsLinksRequiredPaths(t *testing.T) {
+	src := t.TempDir()
+	if err := os.MkdirAll(path.Join(src, "lib", "nested"), 0755); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "lib", "nested", "module.js"), []byte("module"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "resolv.conf"), []byte("nameserver"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Symlink("resolv.conf", path.Join(src, "link.conf")); err != nil {
+		t.Fatal(err)
+	}
+
+	rootfs := NewSandboxRootfs(path.Join(t.TempDir(), "rootfs"))
+	err := rootfs.Ensure([]string{
+		path.Join(src, "lib"),
+		path.Join(src, "resolv.conf"),
+		path.Join(src, "link.conf"),
+		path.Join(src, "missing"),
+	})
+	if err != nil {
+		t.Fatalf("ensure rootfs: %v", err)
+	}
+
+	linked, err := os.Stat(path.Join(rootfs.Root(), src, "lib", "nested", "module.js"))
+	if err != nil {
+		t.Fatalf("expected nested file in rootfs: %v", err)
+	}
+	original, _ := os.Stat(path.Join(src, "lib", "nested", "module.js"))
+	if linked.Sys().(*syscall.Stat_t).Ino != original.Sys().(*syscall.Stat_t).Ino {
+		t.Fatal("expected file to be hardlinked instead of copied")
+	}
+
+	target, err := os.Readlink(path.Join(rootfs.Root(), src, "link.conf"))
+	if err != nil || target != "resolv.conf" {
+		t.Fatalf("expected symlink to be preserved, got %q, %v", target, err)
+	}
+
+	if _, err := os.Lstat(path.Join(rootfs.Root(), src, "missing")); err == nil {
+		t.Fatal("expected missing path to be skipped")
+	}
+}
+
+func TestSandboxRootfsRebuildsAfterRemoval(t *testing.T) {
+	src := t.TempDir()
+	if err := os.WriteFile(path.Join(src, "hosts"), []byte("127.0.0.1"), 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	rootfs := NewSandboxRootfs(path.Join(t.TempDir(), "rootfs"))
+	if err := rootfs.Ensure([]string{path.Join(src, "hosts")}); err != nil {
+		t.Fatal(err)
+	}
+
+	runDir, err := rootfs.CreateRunDir(src)
+	if err != nil {
+		t.Fatalf("create run dir: %v", err)
+	}
+	info, err := os.Stat(runDir)
+	if err != nil || info.Mode().Perm() != 0700 {
+		t.Fatalf("expected private run dir, got %v, %v", info, err)
+	}
+
+	os.RemoveAll(rootfs.Root())
+	if err := rootfs.Ensure([]string{path.Join(src, "hosts")}); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := os.Stat(path.Join(rootfs.Root(), src, "hosts")); err != nil {
+		t.Fatalf("expected rootfs to be rebuilt: %v", err)
+	}
+}
+
+func TestSandboxRootfsSyncReplacesChangedFilesInPlace(t *testing.T) {
+	src := t.TempDir()
+	for _, name := range []string{"nodejs.so", "hosts"} {
+		if err := os.WriteFile(path.Join(src, name), []byte(name), 0644); err != nil {
+			t.Fatal(err)
+		}
+	}
+	paths := []string{path.Join(src, "nodejs.so"), path.Join(src, "hosts")}
+
+	rootfs := NewSandboxRootfs(path.Join(t.TempDir(), "rootfs"))
+	if err := rootfs.Ensure(paths); err != nil {
+		t.Fatal(err)
+	}
+	runDir, err := rootfs.CreateRunDir(src)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// rewritten like releaseLibBinary does, hosts is gone
+	if err := os.Remove(path.Join(src, "nodejs.so")); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "nodejs.so"), []byte("rebuilt"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Remove(path.Join(src, "hosts")); err != nil {
+		t.Fatal(err)
+	}
+
+	// Ensure trusts the last sync
+	if err := rootfs.Ensure(paths); err != nil {
+		t.Fatal(err)
+	}
+	if data, _ := os.ReadFile(path.Join(rootfs.Root(), src, "nodejs.so")); string(data) != "nodejs.so" {
+		t.Fatalf("expected Ensure to keep the synced file, got %q", data)
+	}
+
+	if err := rootfs.Sync(paths); err != nil {
+		t.Fatal(err)
+	}
+	if data, _ := os.ReadFile(path.Join(rootfs.Root(), src, "nodejs.so")); string(data) != "rebuilt" {
+		t.Fatalf("expected the changed file to be replaced, got %q", data)
+	}
+	if _, err := os.Lstat(path.Join(rootfs.Root(), src, "hosts")); err == nil {
+		t.Fatal("expected the removed file to be removed from the rootfs")
+	}
+	if _, err := os.Stat(runDir); err != nil {
+		t.Fatalf("expected the run dir to survive the sync: %v", err)
+	}
+}
+
+func TestSandboxRootfsKeepsRootAfterFailedSync(t *testing.T) {
+	src := t.TempDir()
+	if err := os.MkdirAll(path.Join(src, "lib"), 0755); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "lib", "module.js"), []byte("v1"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	paths := []string{path.Join(src, "lib")}
+
+	rootfs := NewSandboxRootfs(path.Join(t.TempDir(), "rootfs"))
+	if err := rootfs.Ensure(paths); err != nil {
+		t.Fatal(err)
+	}
+	// a run is chrooted into the root
+	runDir := path.Join(rootfs.Root(), "run")
+	if err := os.Mkdir(runDir, 0700); err != nil {
+		t.Fatal(err)
+	}
+
+	// the directory cannot be recreated, the sync fails halfway
+	if err := os.RemoveAll(path.Join(rootfs.Root(), src, "lib")); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(rootfs.Root(), src, "lib"), nil, 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "lib", "module.js"), []byte("v2"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := rootfs.Sync(paths); err == nil {
+		t.Fatal("expected the sync to fail")
+	}
+
+	if err := rootfs.Ensure(paths); err != nil {
+		t.Fatal(err)
+	}
+	if err := rootfs.Sync(paths); err == nil {
+		t.Fatal("expected the sync to fail again")
+	}
+	if _, err := os.Stat(runDir); err != nil {
+		t.Fatalf("expected the root of running runs to stay in place: %v", err)
+	}
+}
+
+func TestSandboxRootfsRefreshReplacesRewrittenFiles(t *testing.T) {
+	src := t.TempDir()
+	resolv := path.Join(src, "resolv.conf")
+	if err := os.WriteFile(resolv, []byte("nameserver 10.0.0.1\n"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(path.Join(src, "module.js"), []byte("v1"), 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	rootfs := NewSandboxRootfs(path.Join(t.TempDir(), "rootfs"))
+	if err := rootfs.Ensure([]string{resolv, path.Join(src, "module.js")}); err != nil {
+		t.Fatal(err)
+	}
+
+	// rewritten by a rename like the runtime does on a network change
+	if err := os.WriteFile(resolv+".new", []byte("nameserver 10.0.0.2\n"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Rename(resolv+".new", resolv); err != nil {
+		t.Fatal(err)
+	}
+	if err := rootfs.Refresh([]string{resolv, path.Join(src, "missing")}); err != nil {
+		t.Fatal(err)
+	}
+	content, err := os.ReadFile(path.Join(rootfs.Root(), resolv))
+	if err != nil || string(content) != "nameserver 10.0.0.2\n" {
+		t.Fatalf("expected the rewritten resolv.conf, got %q, %v", content, err)
+	}
+	if _, err := os.Lstat(path.Join(rootfs.Root(), src, "missing")); err == nil {
+		t.Fatal("expected paths outside the rootfs to be left to Sync")
+	}
+}
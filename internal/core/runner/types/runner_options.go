@@ -9,6 +9,9 @@ type Dependency struct {
 
 type RunnerOptions struct {
 	EnableNetwork bool `json:"enable_network"`
+	// Batch is set by the runners for RunBatch, the prescript then reads
+	// framed inputs from fd 3 and answers each of them on fd 5
+	Batch bool `json:"batch"`
 }
 
 func (r *RunnerOptions) Json() string {
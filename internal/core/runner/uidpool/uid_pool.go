@@ -7,10 +7,19 @@ import (
 	"log/slog"
 	"os"
 	"sync"
+	"sync/atomic"
+
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
 )
 
 var ErrUIDPoolExhausted = errors.New("sandbox UID pool exhausted")
 
+// sandbox processes run as one of the UIDs in [MinUID, MaxUID)
+const (
+	MinUID = 10000
+	MaxUID = 11000
+)
+
 type UIDPool struct {
 	pool chan int
 	min  int
@@ -50,16 +59,35 @@ func (p *UIDPool) Len() int {
 }
 
 var (
-	globalPool     *UIDPool
+	globalPool     atomic.Pointer[UIDPool]
 	globalPoolOnce sync.Once
 )
 
-func AcquireUID(ctx context.Context) (int, error) {
+func init() {
+	metrics.DefaultRegistry.Register(metrics.NewGaugeFunc(
+		"dify_sandbox_free_uids",
+		"Sandbox UIDs currently available in the pool.",
+		func() float64 {
+			// a scrape must not create the pool, that edits /etc/passwd
+			pool := globalPool.Load()
+			if pool == nil {
+				return 0
+			}
+			return float64(pool.Len())
+		},
+	))
+}
+
+func getGlobalPool() *UIDPool {
 	globalPoolOnce.Do(func() {
-		globalPool = NewUIDPool(10000, 11000)
-		ensurePasswdEntries(10000, 11000)
+		ensurePasswdEntries(MinUID, MaxUID)
+		globalPool.Store(NewUIDPool(MinUID, MaxUID))
 	})
-	return globalPool.Acquire(ctx)
+	return globalPool.Load()
+}
+
+func AcquireUID(ctx context.Context) (int, error) {
+	return getGlobalPool().Acquire(ctx)
 }
 
 // ensurePasswdEntries appends sandbox UIDs to /etc/passwd so that
@@ -78,8 +106,5 @@ func ensurePasswdEntries(min, max int) {
 }
 
 func ReleaseUID(uid int) {
-	globalPoolOnce.Do(func() {
-		globalPool = NewUIDPool(10000, 11000)
-	})
-	globalPool.Release(uid)
+	getGlobalPool().Release(uid)
 }
@@ -2,6 +2,7 @@ package uidpool
 
 import (
 	"context"
+	"strconv"
 	"sync"
 	"testing"
 	"time"
@@ -186,3 +187,23 @@ func TestReleaseRestoresCapacity(t *testing.T) {
 		seen[uid] = true
 	}
 }
+
+func BenchmarkAcquireRelease(b *testing.B) {
+	// fewer UIDs than goroutines, so acquirers contend and wait for releases
+	for _, size := range []int{4, 1000} {
+		b.Run(strconv.Itoa(size), func(b *testing.B) {
+			pool := NewUIDPool(10000, 10000+size)
+			ctx := context.Background()
+			b.SetParallelism(4)
+			b.RunParallel(func(pb *testing.PB) {
+				for pb.Next() {
+					uid, err := pool.Acquire(ctx)
+					if err != nil {
+						b.Fatal(err)
+					}
+					pool.Release(uid)
+				}
+			})
+		})
+	}
+}
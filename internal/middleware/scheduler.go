@@ -0,0 +1,547 @@
+package middleware
+
+import (
+	"bytes"
+	"context"
+	"encoding/json"
+	"errors"
+	"io"
+	"log/slog"
+	"math"
+	"net/http"
+	"runtime"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/gin-gonic/gin"
+	"github.com/langgenius/dify-sandbox/internal/types"
+	"github.com/langgenius/dify-sandbox/internal/utils/metrics"
+)
+
+// WorkerWaitKey holds the time.Duration a request waited for a worker slot.
+// The body is not parsed yet, the handler observes it with its language.
+const WorkerWaitKey = "worker_wait"
+
+var (
+	ErrSchedulerFull     = errors.New("too many requests")
+	ErrQueueWaitTooLong  = errors.New("expected queue wait exceeds the request deadline")
+	ErrQueueWaitTimedOut = errors.New("timed out waiting for a worker")
+)
+
+type SchedulerOptions struct {
+	// MaxWorkers caps the runs executing at once
+	MaxWorkers int
+	// MaxRequests caps running plus queued runs, further runs are rejected
+	MaxRequests int
+	// MaxQueueWait bounds the time a run may wait for a worker, 0 waits until
+	// the request context is done
+	MaxQueueWait time.Duration
+	// LanguageWorkers optionally caps the runs of one language within
+	// MaxWorkers
+	LanguageWorkers map[string]int
+	// Adaptive lowers the concurrency below MaxWorkers, starting from the CPU
+	// count and backing off when the run latency grows
+	Adaptive bool
+	// RunTimeout is the longest a run executes once admitted, a client
+	// timeout sent along with a request minus RunTimeout is what the request
+	// may wait in the queue
+	RunTimeout time.Duration
+	// BatchRunTimeout is RunTimeout for batch runs
+	BatchRunTimeout time.Duration
+}
+
+// Scheduler admits runs into a bounded number of workers. Waiting runs are
+// queued per key, e.g. per tenant, and the keys are served round robin so
+// that a burst from one caller cannot starve the others. A run is shed as
+// soon as its expected wait exceeds the time it has left.
+type Scheduler struct {
+	options SchedulerOptions
+
+	lock              sync.Mutex
+	limit             float64
+	running           int
+	runningByLanguage map[string]int
+	queues            map[string][]*schedulerTicket
+	keys              []string
+	next              int
+	queued            int
+
+	// exponentially weighted service time per language and per batch
+	// language, and over all single runs for the adaptive limit
+	serviceTime    map[string]time.Duration
+	latency        time.Duration
+	minLatency     time.Duration
+	latencySamples int
+
+	setup sync.Once
+}
+
+type schedulerTicket struct {
+	key      string
+	language string
+	// class keys the service time, batches run far longer than single runs
+	// of their language and are estimated apart
+	class    string
+	batch    bool
+	admitted chan struct{}
+}
+
+const (
+	serviceTimeWeight = 0.2
+	// the minimum latency is re-learned periodically so that a single fast
+	// outlier does not pin the adaptive limit down forever
+	minLatencyWindow = 1000
+)
+
+func NewScheduler(options SchedulerOptions) *Scheduler {
+	if options.MaxWorkers <= 0 {
+		options.MaxWorkers = 1
+	}
+	if options.MaxRequests < options.MaxWorkers {
+		options.MaxRequests = options.MaxWorkers
+	}
+
+	limit := options.MaxWorkers
+	if options.Adaptive && runtime.NumCPU() < limit {
+		limit = runtime.NumCPU()
+	}
+
+	return &Scheduler{
+		options:           options,
+		limit:             float64(limit),
+		runningByLanguage: map[string]int{},
+		queues:            map[string][]*schedulerTicket{},
+		serviceTime:       map[string]time.Duration{},
+	}
+}
+
+// Acquire waits for a worker for a run of language on behalf of key. The
+// returned release must be called once the run finished.
+func (s *Scheduler) Acquire(ctx context.Context, key string, language string) (func(), error) {
+	return s.AcquireBefore(ctx, key, language, time.Time{})
+}
+
+// AcquireBefore is Acquire for a run which has to start before deadline, a
+// zero deadline only leaves MaxQueueWait and the deadline of ctx.
+func (s *Scheduler) AcquireBefore(ctx context.Context, key string, language string, deadline time.Time) (func(), error) {
+	return s.acquire(ctx, key, language, false, deadline)
+}
+
+// AcquireBatchBefore is AcquireBefore for a batch run. It draws from the same
+// workers, but its service time neither feeds the estimate of single runs nor
+// the adaptive limit.
+func (s *Scheduler) AcquireBatchBefore(ctx context.Context, key string, language string, deadline time.Time) (func(), error) {
+	return s.acquire(ctx, key, language, true, deadline)
+}
+
+func serviceClass(language string, batch bool) string {
+	if batch {
+		return "batch:" + language
+	}
+	return language
+}
+
+func (s *Scheduler) acquire(ctx context.Context, key string, language string, batch bool, deadline time.Time) (func(), error) {
+	now := time.Now()
+	class := serviceClass(language, batch)
+
+	if s.options.MaxQueueWait > 0 {
+		if maxWait := now.Add(s.options.MaxQueueWait); deadline.IsZero() || maxWait.Before(deadline) {
+			deadline = maxWait
+		}
+	}
+	if ctxDeadline, ok := ctx.Deadline(); ok && (deadline.IsZero() || ctxDeadline.Before(deadline)) {
+		deadline = ctxDeadline
+	}
+
+	s.lock.Lock()
+	if s.running+s.queued >= s.options.MaxRequests {
+		s.lock.Unlock()
+		return nil, ErrSchedulerFull
+	}
+
+	if !deadline.IsZero() {
+		// nothing to wait for is never shed, even once the deadline passed
+		if expected := s.expectedWait(key, language, class); expected > 0 && expected > deadline.Sub(now) {
+			s.lock.Unlock()
+			return nil, ErrQueueWaitTooLong
+		}
+	}
+
+	ticket := &schedulerTicket{
+		key:      key,
+		language: language,
+		class:    class,
+		batch:    batch,
+		admitted: make(chan struct{}),
+	}
+	if len(s.queues[key]) == 0 {
+		s.keys = append(s.keys, key)
+	}
+	s.queues[key] = append(s.queues[key], ticket)
+	s.queued++
+	s.dispatch()
+	s.lock.Unlock()
+
+	// admitted right away, a deadline which already passed must not race it
+	select {
+	case <-ticket.admitted:
+		return s.releaseFunc(ticket), nil
+	default:
+	}
+
+	var timeout <-chan time.Time
+	if !deadline.IsZero() {
+		timer := time.NewTimer(time.Until(deadline))
+		defer timer.Stop()
+		timeout = timer.C
+	}
+
+	var err error
+	select {
+	case <-ticket.admitted:
+		return s.releaseFunc(ticket), nil
+	case <-timeout:
+		err = ErrQueueWaitTimedOut
+	case <-ctx.Done():
+		err = ctx.Err()
+	}
+
+	s.lock.Lock()
+	defer s.lock.Unlock()
+	select {
+	case <-ticket.admitted:
+		// admitted while giving up, hand the worker back
+		s.release(ticket, 0)
+	default:
+		s.dequeue(ticket)
+	}
+	return nil, err
+}
+
+func (s *Scheduler) releaseFunc(ticket *schedulerTicket) func() {
+	admittedAt := time.Now()
+	var once sync.Once
+	return func() {
+		once.Do(func() {
+			s.lock.Lock()
+			defer s.lock.Unlock()
+			s.release(ticket, time.Since(admittedAt))
+		})
+	}
+}
+
+// release frees the worker of an admitted ticket, serviceTime is 0 if the
+// ticket never ran.
+func (s *Scheduler) release(ticket *schedulerTicket, serviceTime time.Duration) {
+	s.running--
+	s.runningByLanguage[ticket.language]--
+	if s.runningByLanguage[ticket.language] == 0 {
+		delete(s.runningByLanguage, ticket.language)
+	}
+	if serviceTime > 0 {
+		s.observeServiceTime(ticket, serviceTime)
+	}
+	s.dispatch()
+}
+
+// dispatch admits queued tickets round robin across keys while workers are
+// free. Within a key the oldest ticket whose language has room goes first.
+func (s *Scheduler) dispatch() {
+	for s.queued > 0 && s.running < int(s.limit) {
+		admitted := false
+		for i := 0; i < len(s.keys) && !admitted; i++ {
+			index := (s.next + i) % len(s.keys)
+			for _, ticket := range s.queues[s.keys[index]] {
+				if !s.languageHasRoom(ticket.language) {
+					continue
+				}
+
+				s.dequeue(ticket)
+				s.running++
+				s.runningByLanguage[ticket.language]++
+				close(ticket.admitted)
+
+				// continue after this key, dequeue may have removed it
+				if index < len(s.keys) && s.keys[index] == ticket.key {
+					index++
+				}
+				s.next = index
+				admitted = true
+				break
+			}
+		}
+
+		if !admitted {
+			return
+		}
+	}
+}
+
+func (s *Scheduler) dequeue(ticket *schedulerTicket) {
+	queue := s.queues[ticket.key]
+	for i, queued := range queue {
+		if queued != ticket {
+			continue
+		}
+
+		queue = append(queue[:i], queue[i+1:]...)
+		s.queued--
+		break
+	}
+
+	if len(queue) > 0 {
+		s.queues[ticket.key] = queue
+		return
+	}
+
+	delete(s.queues, ticket.key)
+	for i, key := range s.keys {
+		if key == ticket.key {
+			s.keys = append(s.keys[:i], s.keys[i+1:]...)
+			if s.next > i {
+				s.next--
+			}
+			break
+		}
+	}
+}
+
+func (s *Scheduler) languageHasRoom(language string) bool {
+	limit, ok := s.options.LanguageWorkers[language]
+	return !ok || limit <= 0 || s.runningByLanguage[language] < limit
+}
+
+// expectedWait estimates the queue wait of a new ticket. With round robin
+// every other waiting key is served once per turn of key, so the ticket
+// starts after roughly (own backlog + 1) turns.
+func (s *Scheduler) expectedWait(key string, language string, class string) time.Duration {
+	if s.queued == 0 && s.running < int(s.limit) && s.languageHasRoom(language) {
+		return 0
+	}
+
+	serviceTime, ok := s.serviceTime[class]
+	if !ok {
+		// nothing measured yet, never shed on a guess
+		return 0
+	}
+
+	keys := len(s.keys)
+	if len(s.queues[key]) == 0 {
+		keys++
+	}
+	ahead := (len(s.queues[key]) + 1) * keys
+	if ahead > s.queued+1 {
+		ahead = s.queued + 1
+	}
+
+	return time.Duration(float64(serviceTime) * float64(ahead) / s.limit)
+}
+
+func (s *Scheduler) observeServiceTime(ticket *schedulerTicket, serviceTime time.Duration) {
+	if previous, ok := s.serviceTime[ticket.class]; ok {
+		serviceTime = time.Duration(serviceTimeWeight*float64(serviceTime) + (1-serviceTimeWeight)*float64(previous))
+	}
+	s.serviceTime[ticket.class] = serviceTime
+
+	// a batch taking long is not a sign of overload
+	if !s.options.Adaptive || ticket.batch {
+		return
+	}
+
+	if s.latency == 0 {
+		s.latency = serviceTime
+	} else {
+		s.latency = time.Duration(serviceTimeWeight*float64(serviceTime) + (1-serviceTimeWeight)*float64(s.latency))
+	}
+
+	s.latencySamples++
+	if s.minLatency == 0 || s.latency < s.minLatency || s.latencySamples >= minLatencyWindow {
+		s.minLatency = s.latency
+		s.latencySamples = 0
+	}
+
+	// gradient limit: shrink while latency rises above the best seen, leave
+	// sqrt(limit) of headroom so that the limit can grow back
+	gradient := math.Max(0.5, math.Min(1, float64(s.minLatency)/float64(s.latency)))
+	limit := s.limit*gradient + math.Sqrt(s.limit)
+	limit = (1-serviceTimeWeight)*s.limit + serviceTimeWeight*limit
+	s.limit = math.Max(1, math.Min(float64(s.options.MaxWorkers), limit))
+}
+
+func (s *Scheduler) stats() (running int, queued int, limit int) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+	return s.running, s.queued, int(s.limit)
+}
+
+func (s *Scheduler) registerMetrics() {
+	metrics.DefaultRegistry.Register(metrics.NewGaugeFunc(
+		"dify_sandbox_requests_in_flight",
+		"Run requests admitted by the scheduler, waiting or running.",
+		func() float64 {
+			running, queued, _ := s.stats()
+			return float64(running + queued)
+		},
+	))
+	metrics.DefaultRegistry.Register(metrics.NewGaugeFunc(
+		"dify_sandbox_worker_queue_depth",
+		"Run requests waiting for a worker.",
+		func() float64 {
+			_, queued, _ := s.stats()
+			return float64(queued)
+		},
+	))
+	metrics.DefaultRegistry.Register(metrics.NewGaugeFunc(
+		"dify_sandbox_workers_busy",
+		"Workers running a request.",
+		func() float64 {
+			running, _, _ := s.stats()
+			return float64(running)
+		},
+	))
+	metrics.DefaultRegistry.Register(metrics.NewGaugeFunc(
+		"dify_sandbox_worker_limit",
+		"Current concurrency limit, below max_workers when adaptive.",
+		func() float64 {
+			_, _, limit := s.stats()
+			return float64(limit)
+		},
+	))
+}
+
+var schedulerRejections = metrics.NewCounterVec(
+	"dify_sandbox_scheduler_rejections_total",
+	"Run requests rejected by the scheduler.",
+	"reason",
+)
+
+func init() {
+	metrics.DefaultRegistry.Register(schedulerRejections)
+}
+
+// maxRunRequestBytes bounds the body of a run request, the scheduler reads it
+// before any handler could reject it.
+const maxRunRequestBytes = 16 << 20
+
+// Schedule admits the run endpoints into scheduler. Requests are keyed by
+// tenantHeader, falling back to the api key. The key is trusted as sent:
+// callers sharing one api key share one queue unless they send the header,
+// and a caller can claim more than its share by rotating it, so it should be
+// set by Dify or a proxy in front of the sandbox rather than by end users.
+//
+// timeoutHeader optionally carries the seconds the client waits for the
+// response, the request is shed once it cannot start early enough to finish
+// its run in that time. Without it a request waits up to MaxQueueWait.
+func Schedule(scheduler *Scheduler, tenantHeader string, timeoutHeader string) gin.HandlerFunc {
+	return schedule(scheduler, tenantHeader, timeoutHeader, false)
+}
+
+// ScheduleBatch is Schedule for the batch endpoint, the client timeout is
+// budgeted against BatchRunTimeout.
+func ScheduleBatch(scheduler *Scheduler, tenantHeader string, timeoutHeader string) gin.HandlerFunc {
+	return schedule(scheduler, tenantHeader, timeoutHeader, true)
+}
+
+func schedule(scheduler *Scheduler, tenantHeader string, timeoutHeader string, batch bool) gin.HandlerFunc {
+	scheduler.setup.Do(func() {
+		slog.Info("setting up run scheduler",
+			"max_workers", scheduler.options.MaxWorkers,
+			"max_requests", scheduler.options.MaxRequests,
+			"max_queue_wait", scheduler.options.MaxQueueWait,
+			"language_workers", scheduler.options.LanguageWorkers,
+			"adaptive", scheduler.options.Adaptive,
+		)
+		scheduler.registerMetrics()
+	})
+
+	acquire := scheduler.AcquireBefore
+	runTimeout := scheduler.options.RunTimeout
+	if batch {
+		acquire = scheduler.AcquireBatchBefore
+		runTimeout = scheduler.options.BatchRunTimeout
+	}
+
+	return func(c *gin.Context) {
+		key := c.GetHeader(tenantHeader)
+		if key == "" {
+			key = c.GetHeader("X-Api-Key")
+		}
+
+		waitStart := time.Now()
+		var deadline time.Time
+		if timeout, err := strconv.ParseFloat(c.GetHeader(timeoutHeader), 64); err == nil && timeout > 0 {
+			budget := time.Duration(timeout*float64(time.Second)) - runTimeout
+			deadline = waitStart.Add(max(budget, 0))
+		}
+
+		language, err := requestLanguage(c)
+		if err != nil {
+			c.JSON(http.StatusRequestEntityTooLarge, types.ErrorResponse(-413, err.Error()))
+			c.Abort()
+			return
+		}
+
+		release, err := acquire(c.Request.Context(), key, language, deadline)
+		if err != nil {
+			switch {
+			case errors.Is(err, ErrSchedulerFull):
+				schedulerRejections.Inc("full")
+				c.JSON(http.StatusServiceUnavailable, types.ErrorResponse(-503, "Too many requests"))
+			case errors.Is(err, ErrQueueWaitTooLong):
+				schedulerRejections.Inc("deadline")
+				c.JSON(http.StatusServiceUnavailable, types.ErrorResponse(-503, err.Error()))
+			case errors.Is(err, ErrQueueWaitTimedOut):
+				schedulerRejections.Inc("timeout")
+				c.JSON(http.StatusServiceUnavailable, types.ErrorResponse(-503, err.Error()))
+			default:
+				// the client went away
+				schedulerRejections.Inc("canceled")
+			}
+			c.Abort()
+			return
+		}
+		defer release()
+
+		c.Set(WorkerWaitKey, time.Since(waitStart))
+		c.Next()
+	}
+}
+
+// requestLanguage reads the language of a run request ahead of the handler,
+// the body is put back for it to bind. Unsupported languages are reported as
+// "" to keep the per language state bounded, the handler rejects them. A body
+// above maxRunRequestBytes is an error.
+func requestLanguage(c *gin.Context) (string, error) {
+	if c.Request.Body != nil {
+		c.Request.Body = http.MaxBytesReader(c.Writer, c.Request.Body, maxRunRequestBytes)
+	}
+
+	language := ""
+	if !strings.HasPrefix(c.GetHeader("Content-Type"), "application/json") {
+		language = c.PostForm("language")
+	} else if c.Request.Body != nil {
+		body, err := io.ReadAll(c.Request.Body)
+		c.Request.Body.Close()
+		if tooLarge := (*http.MaxBytesError)(nil); errors.As(err, &tooLarge) {
+			return "", err
+		}
+		c.Request.Body = io.NopCloser(bytes.NewReader(body))
+		if err == nil {
+			var request struct {
+				Language string `json:"language"`
+			}
+			json.Unmarshal(body, &request)
+			language = request.Language
+		}
+	}
+
+	switch language {
+	case metrics.LanguagePython3, metrics.LanguageNodeJs:
+		return language, nil
+	default:
+		return "", nil
+	}
+}
@@ -0,0 +1,136 @@
+package middleware
+
+import (
+	"context"
+	"sort"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+// admission is one way of admitting a run, either the semaphore that
+// MaxRequest+MaxWorker used to be or the Scheduler.
+type admission func(ctx context.Context, key string) (func(), error)
+
+// legacyAdmission rejects above maxRequests and lets the waiting runs race
+// for maxWorkers slots.
+func legacyAdmission(maxWorkers int, maxRequests int) admission {
+	requests := atomic.Int64{}
+	sem := make(chan struct{}, maxWorkers)
+
+	return func(ctx context.Context, key string) (func(), error) {
+		if requests.Add(1) > int64(maxRequests) {
+			requests.Add(-1)
+			return nil, ErrSchedulerFull
+		}
+		sem <- struct{}{}
+		return func() {
+			<-sem
+			requests.Add(-1)
+		}, nil
+	}
+}
+
+func schedulerAdmission(options SchedulerOptions) admission {
+	s := NewScheduler(options)
+	return func(ctx context.Context, key string) (func(), error) {
+		return s.Acquire(ctx, key, "python3")
+	}
+}
+
+type loadResult struct {
+	latencies map[string][]time.Duration
+	rejected  map[string]int
+}
+
+// runMixedLoad replays a burst from one workflow on top of steady traffic
+// from another. Every run takes serviceTime once admitted.
+func runMixedLoad(admit admission, serviceTime time.Duration) loadResult {
+	result := loadResult{
+		latencies: map[string][]time.Duration{},
+		rejected:  map[string]int{},
+	}
+	var lock sync.Mutex
+	var wg sync.WaitGroup
+
+	request := func(key string) {
+		defer wg.Done()
+		start := time.Now()
+		release, err := admit(context.Background(), key)
+		if err != nil {
+			lock.Lock()
+			result.rejected[key]++
+			lock.Unlock()
+			return
+		}
+		time.Sleep(serviceTime)
+		release()
+
+		lock.Lock()
+		result.latencies[key] = append(result.latencies[key], time.Since(start))
+		lock.Unlock()
+	}
+
+	// the burst lands first, steady requests keep arriving while it drains
+	for i := 0; i < 200; i++ {
+		wg.Add(1)
+		go request("burst")
+	}
+	for i := 0; i < 50; i++ {
+		wg.Add(1)
+		go request("steady")
+		time.Sleep(serviceTime / 2)
+	}
+
+	wg.Wait()
+	return result
+}
+
+func percentile(latencies []time.Duration, p float64) time.Duration {
+	if len(latencies) == 0 {
+		return 0
+	}
+	sorted := append([]time.Duration(nil), latencies...)
+	sort.Slice(sorted, func(i, j int) bool { return sorted[i] < sorted[j] })
+	return sorted[int(p*float64(len(sorted)-1))]
+}
+
+// BenchmarkSchedulerMixedLoad compares the latency of steady traffic under a
+// burst from another key, legacy against the scheduler. Wall clock
+// percentiles are too noisy to assert on, they are reported as metrics.
+func BenchmarkSchedulerMixedLoad(b *testing.B) {
+	const (
+		maxWorkers  = 4
+		maxRequests = 500
+		serviceTime = 5 * time.Millisecond
+	)
+
+	runs := []struct {
+		name  string
+		admit func() admission
+	}{
+		{"legacy", func() admission { return legacyAdmission(maxWorkers, maxRequests) }},
+		{"scheduler", func() admission {
+			return schedulerAdmission(SchedulerOptions{
+				MaxWorkers:   maxWorkers,
+				MaxRequests:  maxRequests,
+				MaxQueueWait: 10 * time.Second,
+			})
+		}},
+	}
+
+	for _, run := range runs {
+		b.Run(run.name, func(b *testing.B) {
+			steady := []time.Duration{}
+			burst := []time.Duration{}
+			for i := 0; i < b.N; i++ {
+				result := runMixedLoad(run.admit(), serviceTime)
+				steady = append(steady, result.latencies["steady"]...)
+				burst = append(burst, result.latencies["burst"]...)
+			}
+			b.ReportMetric(float64(percentile(steady, 0.99))/float64(time.Millisecond), "steady-p99-ms")
+			b.ReportMetric(float64(percentile(burst, 0.99))/float64(time.Millisecond), "burst-p99-ms")
+		})
+	}
+}
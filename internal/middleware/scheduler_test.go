@@ -0,0 +1,232 @@
+package middleware
+
+import (
+	"context"
+	"errors"
+	"testing"
+	"time"
+)
+
+func acquireAsync(s *Scheduler, ctx context.Context, key string, language string) chan func() {
+	admitted := make(chan func(), 1)
+	go func() {
+		release, err := s.Acquire(ctx, key, language)
+		if err != nil {
+			close(admitted)
+			return
+		}
+		admitted <- release
+	}()
+	return admitted
+}
+
+func waitQueued(t *testing.T, s *Scheduler, queued int) {
+	t.Helper()
+	for i := 0; i < 1000; i++ {
+		if _, q, _ := s.stats(); q == queued {
+			return
+		}
+		time.Sleep(time.Millisecond)
+	}
+	t.Fatalf("expected %d queued requests", queued)
+}
+
+func TestSchedulerServesKeysRoundRobin(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 100})
+
+	release, err := s.Acquire(context.Background(), "busy", "python3")
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// a burst from one tenant queues first, another tenant arrives later
+	burst := []chan func(){}
+	for i := 0; i < 3; i++ {
+		burst = append(burst, acquireAsync(s, context.Background(), "busy", "python3"))
+		waitQueued(t, s, i+1)
+	}
+	other := acquireAsync(s, context.Background(), "other", "python3")
+	waitQueued(t, s, 4)
+
+	release()
+	next := <-burst[0]
+	next()
+
+	select {
+	case release := <-other:
+		release()
+	case <-time.After(time.Second):
+		t.Fatalf("expected the other tenant to be served before the rest of the burst")
+	}
+
+	for _, admitted := range burst[1:] {
+		(<-admitted)()
+	}
+}
+
+func TestSchedulerRespectsLanguageWorkers(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{
+		MaxWorkers:      2,
+		MaxRequests:     10,
+		LanguageWorkers: map[string]int{"python3": 1},
+	})
+
+	release, err := s.Acquire(context.Background(), "a", "python3")
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	python := acquireAsync(s, context.Background(), "a", "python3")
+	waitQueued(t, s, 1)
+
+	// the python run is blocked by its language cap, nodejs passes it
+	nodejs := acquireAsync(s, context.Background(), "a", "nodejs")
+	select {
+	case release := <-nodejs:
+		release()
+	case <-time.After(time.Second):
+		t.Fatalf("expected nodejs to use the free worker")
+	}
+
+	release()
+	(<-python)()
+}
+
+func TestSchedulerRejectsOverMaxRequests(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 1})
+
+	release, err := s.Acquire(context.Background(), "a", "python3")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer release()
+
+	if _, err := s.Acquire(context.Background(), "a", "python3"); !errors.Is(err, ErrSchedulerFull) {
+		t.Fatalf("expected ErrSchedulerFull, got %v", err)
+	}
+}
+
+func TestSchedulerTimesOutQueuedRequest(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 10, MaxQueueWait: 20 * time.Millisecond})
+
+	release, err := s.Acquire(context.Background(), "a", "python3")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer release()
+
+	if _, err := s.Acquire(context.Background(), "b", "python3"); !errors.Is(err, ErrQueueWaitTimedOut) {
+		t.Fatalf("expected ErrQueueWaitTimedOut, got %v", err)
+	}
+
+	if running, queued, _ := s.stats(); running != 1 || queued != 0 {
+		t.Fatalf("expected the timed out request to leave the queue, got running=%d queued=%d", running, queued)
+	}
+}
+
+func TestSchedulerShedsWhenExpectedWaitExceedsDeadline(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 10, MaxQueueWait: time.Second})
+
+	// teach the scheduler that a python run takes about a second
+	release, _ := s.Acquire(context.Background(), "a", "python3")
+	s.lock.Lock()
+	s.serviceTime["python3"] = time.Second
+	s.lock.Unlock()
+
+	ctx, cancel := context.WithTimeout(context.Background(), 100*time.Millisecond)
+	defer cancel()
+
+	start := time.Now()
+	if _, err := s.Acquire(ctx, "b", "python3"); !errors.Is(err, ErrQueueWaitTooLong) {
+		t.Fatalf("expected ErrQueueWaitTooLong, got %v", err)
+	}
+	if time.Since(start) > 50*time.Millisecond {
+		t.Fatalf("expected the request to be shed without waiting")
+	}
+
+	release()
+}
+
+func TestSchedulerShedsWhenExpectedWaitExceedsClientBudget(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 10, MaxQueueWait: time.Minute})
+
+	release, _ := s.Acquire(context.Background(), "a", "python3")
+	s.lock.Lock()
+	s.serviceTime["python3"] = time.Second
+	s.lock.Unlock()
+
+	// MaxQueueWait alone would let the request wait
+	deadline := time.Now().Add(100 * time.Millisecond)
+	if _, err := s.AcquireBefore(context.Background(), "b", "python3", deadline); !errors.Is(err, ErrQueueWaitTooLong) {
+		t.Fatalf("expected ErrQueueWaitTooLong, got %v", err)
+	}
+
+	release()
+}
+
+func TestSchedulerHandsBackWorkerOfCanceledRequest(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 10})
+
+	release, _ := s.Acquire(context.Background(), "a", "python3")
+
+	ctx, cancel := context.WithCancel(context.Background())
+	canceled := acquireAsync(s, ctx, "b", "python3")
+	waitQueued(t, s, 1)
+	cancel()
+	if _, ok := <-canceled; ok {
+		t.Fatalf("expected the canceled request to fail")
+	}
+
+	release()
+	if running, queued, _ := s.stats(); running != 0 || queued != 0 {
+		t.Fatalf("expected no leaked workers, got running=%d queued=%d", running, queued)
+	}
+}
+
+func TestSchedulerKeepsBatchesOutOfSingleRunEstimate(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 10})
+
+	release, err := s.AcquireBatchBefore(context.Background(), "a", "python3", time.Time{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	time.Sleep(20 * time.Millisecond)
+	release()
+
+	s.lock.Lock()
+	_, single := s.serviceTime["python3"]
+	batch := s.serviceTime[serviceClass("python3", true)]
+	s.lock.Unlock()
+	if single || batch == 0 {
+		t.Fatalf("expected the batch to be measured apart from single runs, got %v", s.serviceTime)
+	}
+
+	// a long batch estimate does not shed a single run behind it
+	s.lock.Lock()
+	s.serviceTime[serviceClass("python3", true)] = time.Minute
+	s.serviceTime["python3"] = time.Millisecond
+	s.lock.Unlock()
+
+	release, _ = s.AcquireBatchBefore(context.Background(), "a", "python3", time.Time{})
+	deadline := time.Now().Add(100 * time.Millisecond)
+	if _, err := s.AcquireBefore(context.Background(), "b", "python3", deadline); !errors.Is(err, ErrQueueWaitTimedOut) {
+		t.Fatalf("expected the single run to queue until its deadline, got %v", err)
+	}
+	if _, err := s.AcquireBatchBefore(context.Background(), "b", "python3", deadline); !errors.Is(err, ErrQueueWaitTooLong) {
+		t.Fatalf("expected the batch to be shed on the batch estimate, got %v", err)
+	}
+	release()
+}
+
+func TestSchedulerAdmitsIdleWorkerPastDeadline(t *testing.T) {
+	s := NewScheduler(SchedulerOptions{MaxWorkers: 1, MaxRequests: 10})
+
+	// a client budget below the run timeout leaves a deadline of now
+	for i := 0; i < 1000; i++ {
+		release, err := s.AcquireBefore(context.Background(), "a", "python3", time.Now().Add(-time.Millisecond))
+		if err != nil {
+			t.Fatalf("expected an idle worker to be taken, got %v on attempt %d", err, i)
+		}
+		release()
+	}
+}
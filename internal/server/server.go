@@ -7,7 +7,10 @@ import (
 
 	"github.com/gin-gonic/gin"
 	"github.com/langgenius/dify-sandbox/internal/controller"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/cgroup"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/nodejs"
 	"github.com/langgenius/dify-sandbox/internal/core/runner/python"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/uidpool"
 	"github.com/langgenius/dify-sandbox/internal/static"
 	"github.com/langgenius/dify-sandbox/internal/utils/log"
 )
@@ -32,6 +35,9 @@ func initConfig() {
 
 	slog.Info("config init success")
 
+	// one cgroup leaf per sandbox uid, runs are not limited without cgroup v2
+	cgroup.Init(config, uidpool.MinUID, uidpool.MaxUID)
+
 	err = static.SetupRunnerDependencies()
 	if err != nil {
 		slog.Error("failed to setup runner dependencies", "err", err)
@@ -57,6 +63,19 @@ func initServer() {
 }
 
 func initDependencies() {
+	// runs start in the environment of the previous server while it is
+	// brought up to date below
+	if ready, err := python.ResumePythonDependenciesEnv(); err != nil {
+		slog.Warn("failed to resume python dependencies sandbox", "err", err)
+	} else if ready {
+		slog.Info("python dependencies sandbox resumed")
+	}
+
+	slog.Info("initializing nodejs sandbox root")
+	if err := nodejs.PrepareSandboxRootfs(); err != nil {
+		slog.Error("failed to initialize nodejs sandbox root", "err", err)
+	}
+
 	slog.Info("installing python dependencies")
 	dependencies := static.GetRunnerDependencies()
 	err := python.InstallDependencies(dependencies.PythonRequirements)
@@ -74,6 +93,9 @@ func initDependencies() {
 	}
 	slog.Info("python dependencies sandbox initialized")
 
+	// warm interpreters import the dependencies installed above
+	python.StartZygotes()
+
 	// start a ticker to update python dependencies to keep the sandbox up-to-date
 	go func() {
 		updateInterval := static.GetDifySandboxGlobalConfigurations().PythonDepsUpdateInterval
@@ -0,0 +1,192 @@
+package service
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"errors"
+	"sync/atomic"
+	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/python"
+	runner_types "github.com/langgenius/dify-sandbox/internal/core/runner/types"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/uidpool"
+	"github.com/langgenius/dify-sandbox/internal/static"
+	"github.com/langgenius/dify-sandbox/internal/types"
+)
+
+// RunBatchResponse is the /v1/sandbox/run/batch data payload. Results holds
+// one entry per input in input order, each with the same meaning as the
+// /v1/sandbox/run payload of a single run. The usage covers the whole batch
+// process, the results carry none.
+//
+// An uncaught exception fails an item with exit code 1 in both languages.
+// Output is attributed to the item running when it is written: python threads
+// and nodejs timers which outlive their item write into a later one.
+type RunBatchResponse struct {
+	Results []*RunCodeResponse `json:"results"`
+	RunCodeUsage
+}
+
+// batchItemResult is the result frame the prescripts write for every input.
+type batchItemResult struct {
+	Stdout   string `json:"stdout"`
+	Stderr   string `json:"stderr"`
+	ExitCode int    `json:"exit_code"`
+}
+
+type batchStarter func(
+	ctx context.Context,
+	timeout time.Duration,
+	preload string,
+	options *runner_types.RunnerOptions,
+) (*runner.OutputCaptureResult, *runner.BatchPipe, error)
+
+func runBatchCode(
+	ctx context.Context,
+	start batchStarter,
+	code string,
+	inputs []string,
+	preload string,
+	options *runner_types.RunnerOptions,
+) *types.DifySandboxResponse {
+	if err := checkOptions(options); err != nil {
+		return types.ErrorResponse(-400, err.Error())
+	}
+
+	configuration := static.GetDifySandboxGlobalConfigurations()
+	if !configuration.EnablePreload {
+		preload = ""
+	}
+
+	itemTimeout := time.Duration(configuration.WorkerTimeout * int(time.Second))
+
+	// the process deadline backs up the per item timeouts and caps the batch,
+	// items still running or queued when it hits fail like after a crash
+	batchTimeout := min(
+		itemTimeout*time.Duration(len(inputs)),
+		time.Duration(configuration.BatchTimeout)*time.Second,
+	)
+	result, pipe, err := start(ctx, batchTimeout, preload, options)
+	if err != nil {
+		if errors.Is(err, uidpool.ErrUIDPoolExhausted) {
+			return types.ErrorResponse(-429, err.Error())
+		}
+		if errors.Is(err, python.ErrSandboxEnvNotReady) {
+			return types.ErrorResponse(-503, err.Error())
+		}
+		return types.ErrorResponse(-500, err.Error())
+	}
+
+	frameLimit := 0
+	if configuration.MaxStdoutBytes > 0 && configuration.MaxStderrBytes > 0 {
+		frameLimit = configuration.MaxStdoutBytes + configuration.MaxStderrBytes
+	}
+
+	return types.SuccessResponse(collectBatchResponse(result, pipe, code, inputs, itemTimeout, frameLimit))
+}
+
+// collectBatchResponse feeds the code and the inputs to a batch process and
+// reads one result frame per input. Each item has itemTimeout from the moment
+// the previous one finished. Once an item times out or the process dies, that
+// item carries the process failure and every item behind it fails without
+// being run, the items before keep their results.
+//
+// Output written around the per item capture, e.g. straight to fd 1 by a
+// native extension, is only reported on the failed item.
+func collectBatchResponse(
+	result codeOutputResult,
+	pipe *runner.BatchPipe,
+	code string,
+	inputs []string,
+	itemTimeout time.Duration,
+	frameLimit int,
+) *RunBatchResponse {
+	processDone := make(chan *RunCodeResponse, 1)
+	go func() {
+		processDone <- collectRunCodeResponse(result)
+	}()
+
+	go func() {
+		defer pipe.Input.Close()
+		writer := bufio.NewWriter(pipe.Input)
+		if runner.WriteBatchFrame(writer, []byte(code)) != nil {
+			return
+		}
+		for _, input := range inputs {
+			if runner.WriteBatchFrame(writer, []byte(input)) != nil {
+				return
+			}
+		}
+		writer.Flush()
+	}()
+
+	defer pipe.Output.Close()
+	reader := bufio.NewReader(pipe.Output)
+
+	results := make([]*RunCodeResponse, len(inputs))
+	failed := -1
+	var failure error
+	var timedOut atomic.Bool
+	for i := range inputs {
+		timer := time.AfterFunc(itemTimeout, func() {
+			timedOut.Store(true)
+			pipe.Kill()
+		})
+		frame, err := runner.ReadBatchFrame(reader, frameLimit)
+		timer.Stop()
+
+		var item batchItemResult
+		if err == nil {
+			err = json.Unmarshal(frame, &item)
+		}
+		if err != nil {
+			// the process may still be running, e.g. on an oversized frame
+			pipe.Kill()
+			failed = i
+			failure = err
+			break
+		}
+
+		results[i] = &RunCodeResponse{
+			Stdout:   item.Stdout,
+			Stderr:   item.Stderr,
+			Error:    buildExecutionError(item.ExitCode, item.Stderr, ""),
+			ExitCode: item.ExitCode,
+		}
+	}
+
+	process := <-processDone
+	if failed < 0 {
+		return &RunBatchResponse{Results: results, RunCodeUsage: process.RunCodeUsage}
+	}
+
+	crashed := &RunCodeResponse{
+		Stdout:   process.Stdout,
+		Stderr:   process.Stderr,
+		Error:    process.Error,
+		ExitCode: process.ExitCode,
+	}
+	switch {
+	case timedOut.Load():
+		crashed.ExitCode = -1
+		crashed.Error = buildExecutionError(-1, process.Stderr, "error: timeout\n")
+	case errors.Is(failure, runner.ErrBatchFrameTooLarge):
+		crashed.ExitCode = -1
+		crashed.Error = buildExecutionError(-1, process.Stderr, "error: output exceeded the limit\n")
+	case crashed.ExitCode == 0:
+		crashed.ExitCode = -1
+		crashed.Error = buildExecutionError(-1, process.Stderr, "error: batch process exited before the item finished\n")
+	}
+	results[failed] = crashed
+
+	for i := failed + 1; i < len(inputs); i++ {
+		results[i] = &RunCodeResponse{
+			Error:    "error: not executed, the batch process exited\n",
+			ExitCode: -1,
+		}
+	}
+
+	return &RunBatchResponse{Results: results, RunCodeUsage: process.RunCodeUsage}
+}
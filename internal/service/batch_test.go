@@ -0,0 +1,155 @@
+package service
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"io"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
+	"github.com/langgenius/dify-sandbox/internal/core/runner/python"
+	runner_types "github.com/langgenius/dify-sandbox/internal/core/runner/types"
+)
+
+// fakeBatchProcess answers every input with answer until it returns false,
+// then it exits like a crashed process.
+func fakeBatchProcess(answer func(input string) (*batchItemResult, bool)) (*fakeOutputCaptureResult, *runner.BatchPipe) {
+	result := newFakeOutputCaptureResult()
+	inputReader, inputWriter := io.Pipe()
+	outputReader, outputWriter := io.Pipe()
+	killed := make(chan struct{})
+
+	pipe := &runner.BatchPipe{
+		Input:  inputWriter,
+		Output: outputReader,
+		Kill: func() {
+			select {
+			case <-killed:
+			default:
+				close(killed)
+			}
+		},
+	}
+
+	exited := make(chan struct{})
+	go func() {
+		defer close(exited)
+		defer outputWriter.Close()
+		reader := bufio.NewReader(inputReader)
+		if _, err := runner.ReadBatchFrame(reader, 0); err != nil {
+			return
+		}
+		for {
+			input, err := runner.ReadBatchFrame(reader, 0)
+			if err != nil {
+				return
+			}
+			item, ok := answer(string(input))
+			if !ok {
+				result.exitCode = 139
+				return
+			}
+			if item == nil {
+				// hangs until killed
+				<-killed
+				result.exitCode = -1
+				return
+			}
+			frame, _ := json.Marshal(item)
+			runner.WriteBatchFrame(outputWriter, frame)
+		}
+	}()
+
+	go func() {
+		<-exited
+		inputReader.Close()
+		if result.exitCode != 0 {
+			result.GetStderr() <- []byte("fatal\n")
+		}
+		result.GetDone() <- true
+	}()
+
+	return result, pipe
+}
+
+func TestCollectBatchResponseReturnsOneResultPerInput(t *testing.T) {
+	result, pipe := fakeBatchProcess(func(input string) (*batchItemResult, bool) {
+		if input == "bad" {
+			return &batchItemResult{Stderr: "ValueError\n", ExitCode: 1}, true
+		}
+		return &batchItemResult{Stdout: input + "\n"}, true
+	})
+
+	resp := collectBatchResponse(result, pipe, "print(inputs)", []string{"a", "bad", "c"}, time.Second, 0)
+
+	if len(resp.Results) != 3 {
+		t.Fatalf("expected 3 results, got %d", len(resp.Results))
+	}
+	if resp.Results[0].Stdout != "a\n" || resp.Results[0].Error != "" {
+		t.Fatalf("unexpected first result %+v", resp.Results[0])
+	}
+	if resp.Results[1].ExitCode != 1 || !strings.Contains(resp.Results[1].Error, "ValueError") {
+		t.Fatalf("expected the failing item to keep its own error, got %+v", resp.Results[1])
+	}
+	if resp.Results[2].Stdout != "c\n" || resp.Results[2].ExitCode != 0 {
+		t.Fatalf("expected items after a failed one to run, got %+v", resp.Results[2])
+	}
+}
+
+func TestCollectBatchResponseFailsRemainingItemsAfterCrash(t *testing.T) {
+	result, pipe := fakeBatchProcess(func(input string) (*batchItemResult, bool) {
+		if input == "crash" {
+			return nil, false
+		}
+		return &batchItemResult{Stdout: input}, true
+	})
+
+	resp := collectBatchResponse(result, pipe, "", []string{"a", "crash", "c", "d"}, time.Second, 0)
+
+	if resp.Results[0].Stdout != "a" {
+		t.Fatalf("expected the item before the crash to keep its result, got %+v", resp.Results[0])
+	}
+	if resp.Results[1].ExitCode != 139 || !strings.Contains(resp.Results[1].Error, "fatal") {
+		t.Fatalf("expected the crashed item to carry the process failure, got %+v", resp.Results[1])
+	}
+	for _, item := range resp.Results[2:] {
+		if item.ExitCode != -1 || !strings.Contains(item.Error, "not executed") {
+			t.Fatalf("expected the remaining items to fail, got %+v", item)
+		}
+	}
+}
+
+func TestCollectBatchResponseTimesOutSingleItem(t *testing.T) {
+	result, pipe := fakeBatchProcess(func(input string) (*batchItemResult, bool) {
+		if input == "slow" {
+			return nil, true
+		}
+		return &batchItemResult{Stdout: input}, true
+	})
+
+	resp := collectBatchResponse(result, pipe, "", []string{"a", "slow", "c"}, 50*time.Millisecond, 0)
+
+	if resp.Results[0].Stdout != "a" {
+		t.Fatalf("unexpected first result %+v", resp.Results[0])
+	}
+	if resp.Results[1].ExitCode != -1 || !strings.Contains(resp.Results[1].Error, "error: timeout") {
+		t.Fatalf("expected the slow item to time out, got %+v", resp.Results[1])
+	}
+	if !strings.Contains(resp.Results[2].Error, "not executed") {
+		t.Fatalf("expected the item after the timeout to fail, got %+v", resp.Results[2])
+	}
+}
+
+func TestRunBatchCodeReportsUnpreparedEnvironmentAsRetryable(t *testing.T) {
+	start := func(context.Context, time.Duration, string, *runner_types.RunnerOptions) (*runner.OutputCaptureResult, *runner.BatchPipe, error) {
+		return nil, nil, python.ErrSandboxEnvNotReady
+	}
+
+	resp := runBatchCode(context.Background(), start, "print(1)", []string{"1"}, "", &runner_types.RunnerOptions{})
+	if resp.Code != -503 {
+		t.Fatalf("expected a retryable -503 before the environment is prepared, got %+v", resp)
+	}
+}
@@ -11,8 +11,36 @@ import (
 )
 
 func RunNodeJsCode(ctx context.Context, code string, preload string, options *runner_types.RunnerOptions) *types.DifySandboxResponse {
+	result, errResp := runNodeJsCode(ctx, code, preload, options)
+	if errResp != nil {
+		return errResp
+	}
+
+	return types.SuccessResponse(collectRunCodeResponse(result))
+}
+
+// StreamNodeJsCode is the streaming counterpart of RunNodeJsCode, see
+// StreamPython3Code.
+func StreamNodeJsCode(ctx context.Context, code string, preload string, options *runner_types.RunnerOptions, emit func(*RunCodeFrame) error) *types.DifySandboxResponse {
+	result, errResp := runNodeJsCode(ctx, code, preload, options)
+	if errResp != nil {
+		return errResp
+	}
+
+	streamRunCodeResponse(ctx, result, emit)
+	return nil
+}
+
+// RunNodeJsBatch is the nodejs counterpart of RunPython3Batch, the code
+// reads the current input from the `inputs` variable.
+func RunNodeJsBatch(ctx context.Context, code string, inputs []string, preload string, options *runner_types.RunnerOptions) *types.DifySandboxResponse {
+	runner := nodejs.NodeJsRunner{}
+	return runBatchCode(ctx, runner.RunBatch, code, inputs, preload, options)
+}
+
+func runNodeJsCode(ctx context.Context, code string, preload string, options *runner_types.RunnerOptions) (codeOutputResult, *types.DifySandboxResponse) {
 	if err := checkOptions(options); err != nil {
-		return types.ErrorResponse(-400, err.Error())
+		return nil, types.ErrorResponse(-400, err.Error())
 	}
 
 	if !static.GetDifySandboxGlobalConfigurations().EnablePreload {
@@ -26,8 +54,8 @@ func RunNodeJsCode(ctx context.Context, code string, preload string, options *ru
 	runner := nodejs.NodeJsRunner{}
 	result, err := runner.Run(ctx, code, timeout, nil, preload, options)
 	if err != nil {
-		return types.ErrorResponse(-500, err.Error())
+		return nil, types.ErrorResponse(-500, err.Error())
 	}
 
-	return types.SuccessResponse(collectRunCodeResponse(result))
+	return result, nil
 }
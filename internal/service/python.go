@@ -12,8 +12,30 @@ import (
 )
 
 func RunPython3Code(ctx context.Context, code string, preload string, options *runner_types.RunnerOptions) *types.DifySandboxResponse {
+	result, errResp := runPython3Code(ctx, code, preload, options)
+	if errResp != nil {
+		return errResp
+	}
+
+	return types.SuccessResponse(collectRunCodeResponse(result))
+}
+
+// StreamPython3Code runs the code and emits its output as frames. It returns
+// an error response only if the process could not be started, in which case
+// nothing was emitted.
+func StreamPython3Code(ctx context.Context, code string, preload string, options *runner_types.RunnerOptions, emit func(*RunCodeFrame) error) *types.DifySandboxResponse {
+	result, errResp := runPython3Code(ctx, code, preload, options)
+	if errResp != nil {
+		return errResp
+	}
+
+	streamRunCodeResponse(ctx, result, emit)
+	return nil
+}
+
+func runPython3Code(ctx context.Context, code string, preload string, options *runner_types.RunnerOptions) (codeOutputResult, *types.DifySandboxResponse) {
 	if err := checkOptions(options); err != nil {
-		return types.ErrorResponse(-400, err.Error())
+		return nil, types.ErrorResponse(-400, err.Error())
 	}
 
 	if !static.GetDifySandboxGlobalConfigurations().EnablePreload {
@@ -30,12 +52,22 @@ func RunPython3Code(ctx context.Context, code string, preload string, options *r
 	)
 	if err != nil {
 		if errors.Is(err, python.ErrUIDPoolExhausted) {
-			return types.ErrorResponse(-429, err.Error())
+			return nil, types.ErrorResponse(-429, err.Error())
 		}
-		return types.ErrorResponse(-500, err.Error())
+		if errors.Is(err, python.ErrSandboxEnvNotReady) {
+			return nil, types.ErrorResponse(-503, err.Error())
+		}
+		return nil, types.ErrorResponse(-500, err.Error())
 	}
 
-	return types.SuccessResponse(collectRunCodeResponse(result))
+	return result, nil
+}
+
+// RunPython3Batch runs the code once per input in a single sandbox process,
+// the code reads the current input from the `inputs` global.
+func RunPython3Batch(ctx context.Context, code string, inputs []string, preload string, options *runner_types.RunnerOptions) *types.DifySandboxResponse {
+	runner := python.PythonRunner{}
+	return runBatchCode(ctx, runner.RunBatch, code, inputs, preload, options)
 }
 
 type ListDependenciesResponse struct {
@@ -1,8 +1,12 @@
 package service
 
 import (
+	"context"
 	"fmt"
 	"strings"
+	"unicode/utf8"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
 )
 
 type codeOutputResult interface {
@@ -11,6 +15,8 @@ type codeOutputResult interface {
 	GetExecError() chan []byte
 	GetDone() chan bool
 	GetExitCode() int
+	GetUsage() runner.ResourceUsage
+	Kill()
 }
 
 // RunCodeResponse is the public /v1/sandbox/run data payload.
@@ -23,6 +29,25 @@ type RunCodeResponse struct {
 	Stderr   string `json:"stderr"`
 	Error    string `json:"error"`
 	ExitCode int    `json:"exit_code"`
+	RunCodeUsage
+}
+
+// RunCodeUsage is what the sandbox process consumed. CPUTime is in seconds
+// and MemoryPeak in bytes, the memory.peak of the cgroup when cgroups are
+// enabled and the max rss of the process otherwise. OOMKilled is set when the
+// process was killed for exceeding the memory limit of its cgroup.
+type RunCodeUsage struct {
+	CPUTime    float64 `json:"cpu_time,omitempty"`
+	MemoryPeak int64   `json:"memory_peak,omitempty"`
+	OOMKilled  bool    `json:"oom_killed,omitempty"`
+}
+
+func newRunCodeUsage(usage runner.ResourceUsage) RunCodeUsage {
+	return RunCodeUsage{
+		CPUTime:    usage.CPUTime.Seconds(),
+		MemoryPeak: usage.MemoryPeak,
+		OOMKilled:  usage.OOMKilled,
+	}
 }
 
 func collectRunCodeResponse(result codeOutputResult) *RunCodeResponse {
@@ -45,10 +70,11 @@ func collectRunCodeResponse(result codeOutputResult) *RunCodeResponse {
 					exitCode := result.GetExitCode()
 					stderr := stderrStr.String()
 					return &RunCodeResponse{
-						Stdout:   stdoutStr.String(),
-						Stderr:   stderr,
-						Error:    buildExecutionError(exitCode, stderr, execErrorStr.String()),
-						ExitCode: exitCode,
+						Stdout:       stdoutStr.String(),
+						Stderr:       stderr,
+						Error:        buildExecutionError(exitCode, stderr, execErrorStr.String()),
+						ExitCode:     exitCode,
+						RunCodeUsage: newRunCodeUsage(result.GetUsage()),
 					}
 				}
 			}
@@ -62,6 +88,131 @@ func collectRunCodeResponse(result codeOutputResult) *RunCodeResponse {
 	}
 }
 
+// RunCodeFrame is one line of the /v1/sandbox/run/stream NDJSON response.
+// stdout and stderr frames carry raw output chunks as they arrive, the final
+// result frame carries Error, ExitCode and the usage with the same meaning as
+// in RunCodeResponse.
+type RunCodeFrame struct {
+	Type     string `json:"type"`
+	Data     string `json:"data,omitempty"`
+	Error    string `json:"error,omitempty"`
+	ExitCode *int   `json:"exit_code,omitempty"`
+	RunCodeUsage
+}
+
+const (
+	RunCodeFrameStdout = "stdout"
+	RunCodeFrameStderr = "stderr"
+	RunCodeFrameResult = "result"
+)
+
+// utf8Frames splits a byte stream into frames that never end in the middle of
+// a UTF-8 sequence, the capture reads fixed size chunks regardless of encoding.
+type utf8Frames struct {
+	pending []byte
+}
+
+// next returns the complete characters of pending and chunk, an incomplete
+// trailing sequence is held back until the next chunk.
+func (f *utf8Frames) next(chunk []byte) string {
+	data := append(f.pending, chunk...)
+	start := len(data)
+	for i := len(data) - 1; i >= 0 && i >= len(data)-utf8.UTFMax; i-- {
+		if utf8.RuneStart(data[i]) {
+			start = i
+			break
+		}
+	}
+
+	if start < len(data) && !utf8.FullRune(data[start:]) {
+		f.pending = append([]byte(nil), data[start:]...)
+		return string(data[:start])
+	}
+
+	f.pending = nil
+	return string(data)
+}
+
+// flush returns whatever is still held back once the stream ended.
+func (f *utf8Frames) flush() string {
+	data := string(f.pending)
+	f.pending = nil
+	return data
+}
+
+// streamRunCodeResponse emits output frames while the process runs. Once emit
+// fails or ctx is done, e.g. the client went away, the process is killed so
+// that it does not hold its worker and uid until the timeout. The output is
+// still drained so that the capture can finish, but no further frames are
+// emitted.
+func streamRunCodeResponse(ctx context.Context, result codeOutputResult, emit func(*RunCodeFrame) error) {
+	var stderrStr strings.Builder
+	var execErrorStr strings.Builder
+	var stdoutFrames, stderrFrames utf8Frames
+	var emitErr error
+
+	killed := false
+	kill := func() {
+		if !killed {
+			killed = true
+			result.Kill()
+		}
+	}
+	send := func(frame *RunCodeFrame) {
+		if emitErr == nil {
+			emitErr = emit(frame)
+			if emitErr != nil {
+				kill()
+			}
+		}
+	}
+	sendOutput := func(frameType string, data string) {
+		if data != "" {
+			send(&RunCodeFrame{Type: frameType, Data: data})
+		}
+	}
+
+	clientDone := ctx.Done()
+
+	for {
+		select {
+		case <-result.GetDone():
+			for {
+				select {
+				case out := <-result.GetStdout():
+					sendOutput(RunCodeFrameStdout, stdoutFrames.next(out))
+				case err := <-result.GetStderr():
+					stderrStr.Write(err)
+					sendOutput(RunCodeFrameStderr, stderrFrames.next(err))
+				case execErr := <-result.GetExecError():
+					execErrorStr.Write(execErr)
+				default:
+					sendOutput(RunCodeFrameStdout, stdoutFrames.flush())
+					sendOutput(RunCodeFrameStderr, stderrFrames.flush())
+					exitCode := result.GetExitCode()
+					send(&RunCodeFrame{
+						Type:         RunCodeFrameResult,
+						Error:        buildExecutionError(exitCode, stderrStr.String(), execErrorStr.String()),
+						ExitCode:     &exitCode,
+						RunCodeUsage: newRunCodeUsage(result.GetUsage()),
+					})
+					return
+				}
+			}
+		case out := <-result.GetStdout():
+			sendOutput(RunCodeFrameStdout, stdoutFrames.next(out))
+		case err := <-result.GetStderr():
+			stderrStr.Write(err)
+			sendOutput(RunCodeFrameStderr, stderrFrames.next(err))
+		case execErr := <-result.GetExecError():
+			execErrorStr.Write(execErr)
+		case <-clientDone:
+			kill()
+			clientDone = nil
+		}
+	}
+}
+
 func buildExecutionError(exitCode int, stderr string, execError string) string {
 	if exitCode == 0 {
 		return execError
@@ -1,10 +1,15 @@
 package service
 
 import (
+	"context"
 	"encoding/json"
+	"errors"
+	"strconv"
 	"strings"
 	"testing"
+	"unicode/utf8"
 
+	"github.com/langgenius/dify-sandbox/internal/core/runner"
 	"github.com/langgenius/dify-sandbox/internal/types"
 )
 
@@ -14,6 +19,9 @@ type fakeOutputCaptureResult struct {
 	execError chan []byte
 	done      chan bool
 	exitCode  int
+	usage     runner.ResourceUsage
+	killed    int
+	onKill    func()
 }
 
 func newFakeOutputCaptureResult() *fakeOutputCaptureResult {
@@ -45,6 +53,17 @@ func (r *fakeOutputCaptureResult) GetExitCode() int {
 	return r.exitCode
 }
 
+func (r *fakeOutputCaptureResult) GetUsage() runner.ResourceUsage {
+	return r.usage
+}
+
+func (r *fakeOutputCaptureResult) Kill() {
+	r.killed++
+	if r.onKill != nil {
+		r.onKill()
+	}
+}
+
 func TestCollectRunCodeResponseKeepsSuccessfulStderrOutOfError(t *testing.T) {
 	result := newFakeOutputCaptureResult()
 
@@ -131,6 +150,128 @@ func TestCollectRunCodeResponseIncludesExecutionFailureDetails(t *testing.T) {
 	}
 }
 
+func TestStreamRunCodeResponseEmitsFramesInOrder(t *testing.T) {
+	result := newFakeOutputCaptureResult()
+	result.exitCode = 1
+
+	go func() {
+		result.GetStdout() <- []byte("first\n")
+		result.GetStderr() <- []byte("boom\n")
+		result.GetStdout() <- []byte("second\n")
+		result.GetDone() <- true
+	}()
+
+	frames := []*RunCodeFrame{}
+	streamRunCodeResponse(context.Background(), result, func(frame *RunCodeFrame) error {
+		frames = append(frames, frame)
+		return nil
+	})
+
+	if len(frames) != 4 {
+		t.Fatalf("expected 4 frames, got %d", len(frames))
+	}
+
+	if frames[0].Type != RunCodeFrameStdout || frames[0].Data != "first\n" {
+		t.Fatalf("unexpected first frame %+v", frames[0])
+	}
+
+	if frames[1].Type != RunCodeFrameStderr || frames[1].Data != "boom\n" {
+		t.Fatalf("unexpected second frame %+v", frames[1])
+	}
+
+	last := frames[3]
+	if last.Type != RunCodeFrameResult || last.ExitCode == nil || *last.ExitCode != 1 {
+		t.Fatalf("expected result frame with exit code 1, got %+v", last)
+	}
+
+	if !strings.Contains(last.Error, "process exited with code 1") || !strings.Contains(last.Error, "boom\n") {
+		t.Fatalf("expected result error to match the non-streaming response, got %q", last.Error)
+	}
+}
+
+func TestStreamRunCodeResponseKeepsCharactersSplitAcrossChunks(t *testing.T) {
+	result := newFakeOutputCaptureResult()
+	char := []byte("€")
+
+	go func() {
+		result.GetStdout() <- append([]byte("price "), char[:1]...)
+		result.GetStdout() <- append(append([]byte(nil), char[1:]...), []byte("5\n")...)
+		result.GetStderr() <- append([]byte("warn "), char[:2]...)
+		result.GetDone() <- true
+	}()
+
+	stdout := strings.Builder{}
+	stderr := strings.Builder{}
+	streamRunCodeResponse(context.Background(), result, func(frame *RunCodeFrame) error {
+		if !utf8.ValidString(frame.Data) && frame.Type != RunCodeFrameStderr {
+			t.Fatalf("frame split a character: %q", frame.Data)
+		}
+		switch frame.Type {
+		case RunCodeFrameStdout:
+			stdout.WriteString(frame.Data)
+		case RunCodeFrameStderr:
+			stderr.WriteString(frame.Data)
+		}
+		return nil
+	})
+
+	if stdout.String() != "price €5\n" {
+		t.Fatalf("expected the split character to be joined, got %q", stdout.String())
+	}
+
+	// a truncated trailing sequence is flushed as is once the stream ended
+	if stderr.String() != "warn "+string(char[:2]) {
+		t.Fatalf("expected the held back bytes to be flushed, got %q", stderr.String())
+	}
+}
+
+func TestStreamRunCodeResponseDrainsAfterEmitFailure(t *testing.T) {
+	result := newFakeOutputCaptureResult()
+
+	go func() {
+		result.GetStdout() <- []byte("one\n")
+		result.GetStdout() <- []byte("two\n")
+		result.GetDone() <- true
+	}()
+
+	emitted := 0
+	streamRunCodeResponse(context.Background(), result, func(frame *RunCodeFrame) error {
+		emitted++
+		return errors.New("client went away")
+	})
+
+	if emitted != 1 {
+		t.Fatalf("expected no frames after the first failed emit, got %d", emitted)
+	}
+
+	if result.killed != 1 {
+		t.Fatalf("expected the process to be killed once after the failed emit, got %d", result.killed)
+	}
+}
+
+func TestStreamRunCodeResponseKillsProcessWhenClientGoesAway(t *testing.T) {
+	result := newFakeOutputCaptureResult()
+	ctx, cancel := context.WithCancel(context.Background())
+	killed := make(chan struct{})
+	result.onKill = func() { close(killed) }
+
+	go func() {
+		result.GetStdout() <- []byte("one\n")
+		cancel()
+		// the killed process still finishes its capture
+		<-killed
+		result.GetDone() <- true
+	}()
+
+	streamRunCodeResponse(ctx, result, func(frame *RunCodeFrame) error {
+		return nil
+	})
+
+	if result.killed != 1 {
+		t.Fatalf("expected the process to be killed once the request context was done, got %d", result.killed)
+	}
+}
+
 func TestSuccessResponseJSONIncludesStderrAndExitCodeOnSuccess(t *testing.T) {
 	resp := types.SuccessResponse(&RunCodeResponse{
 		Stdout:   "<<RESULT>>ok<<RESULT>>\n",
@@ -218,3 +359,28 @@ func TestSuccessResponseJSONKeepsOuterSuccessForExecutionFailure(t *testing.T) {
 		t.Fatalf("expected serialized error to include full stderr, got %q", payload.Data.Error)
 	}
 }
+
+func BenchmarkCollectRunCodeResponse(b *testing.B) {
+	// 32KiB chunks as handed over by the output capture
+	chunk := make([]byte, 32*1024)
+	for _, chunks := range []int{1, 32} {
+		b.Run(strconv.Itoa(chunks), func(b *testing.B) {
+			b.SetBytes(int64(chunks * len(chunk)))
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				result := newFakeOutputCaptureResult()
+				go func() {
+					for j := 0; j < chunks; j++ {
+						result.GetStdout() <- chunk
+					}
+					result.GetStderr() <- []byte("warning\n")
+					result.GetDone() <- true
+				}()
+
+				if resp := collectRunCodeResponse(result); len(resp.Stdout) != chunks*len(chunk) {
+					b.Fatalf("expected %d bytes of stdout, got %d", chunks*len(chunk), len(resp.Stdout))
+				}
+			}
+		})
+	}
+}
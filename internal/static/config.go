@@ -60,6 +60,48 @@ func InitConfig(path string) error {
 		difySandboxGlobalConfigurations.WorkerTimeout, _ = strconv.Atoi(timeout)
 	}
 
+	batch_timeout := os.Getenv("BATCH_TIMEOUT")
+	if batch_timeout != "" {
+		difySandboxGlobalConfigurations.BatchTimeout, _ = strconv.Atoi(batch_timeout)
+	}
+
+	if difySandboxGlobalConfigurations.BatchTimeout <= 0 {
+		difySandboxGlobalConfigurations.BatchTimeout = 60
+	}
+
+	max_stdout_bytes := os.Getenv("MAX_STDOUT_BYTES")
+	if max_stdout_bytes != "" {
+		difySandboxGlobalConfigurations.MaxStdoutBytes, _ = strconv.Atoi(max_stdout_bytes)
+	}
+
+	// unset falls back to the default, a negative limit disables the cap
+	if difySandboxGlobalConfigurations.MaxStdoutBytes == 0 {
+		difySandboxGlobalConfigurations.MaxStdoutBytes = 64 * 1024 * 1024
+	} else if difySandboxGlobalConfigurations.MaxStdoutBytes < 0 {
+		difySandboxGlobalConfigurations.MaxStdoutBytes = 0
+	}
+
+	max_stderr_bytes := os.Getenv("MAX_STDERR_BYTES")
+	if max_stderr_bytes != "" {
+		difySandboxGlobalConfigurations.MaxStderrBytes, _ = strconv.Atoi(max_stderr_bytes)
+	}
+
+	// unset falls back to the default, a negative limit disables the cap
+	if difySandboxGlobalConfigurations.MaxStderrBytes == 0 {
+		difySandboxGlobalConfigurations.MaxStderrBytes = 64 * 1024 * 1024
+	} else if difySandboxGlobalConfigurations.MaxStderrBytes < 0 {
+		difySandboxGlobalConfigurations.MaxStderrBytes = 0
+	}
+
+	code_cache_max_bytes := os.Getenv("CODE_CACHE_MAX_BYTES")
+	if code_cache_max_bytes != "" {
+		difySandboxGlobalConfigurations.CodeCacheMaxBytes, _ = strconv.Atoi(code_cache_max_bytes)
+	}
+
+	if difySandboxGlobalConfigurations.CodeCacheMaxBytes <= 0 {
+		difySandboxGlobalConfigurations.CodeCacheMaxBytes = 64 * 1024 * 1024
+	}
+
 	api_key := os.Getenv("API_KEY")
 	if api_key != "" {
 		difySandboxGlobalConfigurations.App.Key = api_key
@@ -137,6 +179,106 @@ func InitConfig(path string) error {
 		difySandboxGlobalConfigurations.EnablePreload, _ = strconv.ParseBool(enable_preload)
 	}
 
+	python_zygote_enabled := os.Getenv("PYTHON_ZYGOTE_ENABLED")
+	if python_zygote_enabled != "" {
+		difySandboxGlobalConfigurations.PythonZygote.Enabled, _ = strconv.ParseBool(python_zygote_enabled)
+	}
+
+	python_zygote_pool_size := os.Getenv("PYTHON_ZYGOTE_POOL_SIZE")
+	if python_zygote_pool_size != "" {
+		difySandboxGlobalConfigurations.PythonZygote.PoolSize, _ = strconv.Atoi(python_zygote_pool_size)
+	}
+
+	if difySandboxGlobalConfigurations.PythonZygote.PoolSize <= 0 {
+		difySandboxGlobalConfigurations.PythonZygote.PoolSize = 2
+	}
+
+	python_zygote_max_forks := os.Getenv("PYTHON_ZYGOTE_MAX_FORKS")
+	if python_zygote_max_forks != "" {
+		difySandboxGlobalConfigurations.PythonZygote.MaxForks, _ = strconv.Atoi(python_zygote_max_forks)
+	}
+
+	// recycle zygotes regularly so that dependency updates and leaked state
+	// in the warm interpreter do not live forever
+	if difySandboxGlobalConfigurations.PythonZygote.MaxForks <= 0 {
+		difySandboxGlobalConfigurations.PythonZygote.MaxForks = 1000
+	}
+
+	scheduler_max_queue_wait := os.Getenv("SCHEDULER_MAX_QUEUE_WAIT")
+	if scheduler_max_queue_wait != "" {
+		difySandboxGlobalConfigurations.Scheduler.MaxQueueWait, _ = strconv.Atoi(scheduler_max_queue_wait)
+	}
+
+	scheduler_tenant_header := os.Getenv("SCHEDULER_TENANT_HEADER")
+	if scheduler_tenant_header != "" {
+		difySandboxGlobalConfigurations.Scheduler.TenantHeader = scheduler_tenant_header
+	}
+
+	if difySandboxGlobalConfigurations.Scheduler.TenantHeader == "" {
+		difySandboxGlobalConfigurations.Scheduler.TenantHeader = "X-Tenant-ID"
+	}
+
+	scheduler_timeout_header := os.Getenv("SCHEDULER_TIMEOUT_HEADER")
+	if scheduler_timeout_header != "" {
+		difySandboxGlobalConfigurations.Scheduler.TimeoutHeader = scheduler_timeout_header
+	}
+
+	if difySandboxGlobalConfigurations.Scheduler.TimeoutHeader == "" {
+		difySandboxGlobalConfigurations.Scheduler.TimeoutHeader = "X-Request-Timeout"
+	}
+
+	// e.g. SCHEDULER_LANGUAGE_WORKERS=python3:3,nodejs:1
+	scheduler_language_workers := os.Getenv("SCHEDULER_LANGUAGE_WORKERS")
+	if scheduler_language_workers != "" {
+		language_workers := map[string]int{}
+		for _, entry := range strings.Split(scheduler_language_workers, ",") {
+			language, workers, ok := strings.Cut(strings.TrimSpace(entry), ":")
+			if !ok {
+				return fmt.Errorf("invalid SCHEDULER_LANGUAGE_WORKERS entry %q", entry)
+			}
+			language_workers[language], err = strconv.Atoi(workers)
+			if err != nil {
+				return err
+			}
+		}
+		difySandboxGlobalConfigurations.Scheduler.LanguageWorkers = language_workers
+	}
+
+	scheduler_adaptive := os.Getenv("SCHEDULER_ADAPTIVE")
+	if scheduler_adaptive != "" {
+		difySandboxGlobalConfigurations.Scheduler.Adaptive, _ = strconv.ParseBool(scheduler_adaptive)
+	}
+
+	cgroup_enabled := os.Getenv("CGROUP_ENABLED")
+	if cgroup_enabled != "" {
+		difySandboxGlobalConfigurations.Cgroup.Enabled, _ = strconv.ParseBool(cgroup_enabled)
+	}
+
+	cgroup_root := os.Getenv("CGROUP_ROOT")
+	if cgroup_root != "" {
+		difySandboxGlobalConfigurations.Cgroup.Root = cgroup_root
+	}
+
+	cgroup_memory_max := os.Getenv("CGROUP_MEMORY_MAX")
+	if cgroup_memory_max != "" {
+		difySandboxGlobalConfigurations.Cgroup.MemoryMax, _ = strconv.ParseInt(cgroup_memory_max, 10, 64)
+	}
+
+	cgroup_cpu_max := os.Getenv("CGROUP_CPU_MAX")
+	if cgroup_cpu_max != "" {
+		difySandboxGlobalConfigurations.Cgroup.CPUMax, _ = strconv.ParseFloat(cgroup_cpu_max, 64)
+	}
+
+	cgroup_pids_max := os.Getenv("CGROUP_PIDS_MAX")
+	if cgroup_pids_max != "" {
+		difySandboxGlobalConfigurations.Cgroup.PidsMax, _ = strconv.Atoi(cgroup_pids_max)
+	}
+
+	cgroup_cpuset := os.Getenv("CGROUP_CPUSET")
+	if cgroup_cpuset != "" {
+		difySandboxGlobalConfigurations.Cgroup.Cpuset = cgroup_cpuset
+	}
+
 	allowed_syscalls := os.Getenv("ALLOWED_SYSCALLS")
 	if allowed_syscalls != "" {
 		strs := strings.Split(allowed_syscalls, ",")
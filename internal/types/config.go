@@ -6,10 +6,20 @@ type DifySandboxGlobalConfigurations struct {
 		Debug bool   `yaml:"debug"`
 		Key   string `yaml:"key"`
 	} `yaml:"app"`
-	MaxWorkers    int    `yaml:"max_workers"`
-	MaxRequests   int    `yaml:"max_requests"`
-	WorkerTimeout int    `yaml:"worker_timeout"`
-	PythonPath    string `yaml:"python_path"`
+	MaxWorkers    int `yaml:"max_workers"`
+	MaxRequests   int `yaml:"max_requests"`
+	WorkerTimeout int `yaml:"worker_timeout"`
+	// BatchTimeout caps a whole batch in seconds, every input still has
+	// WorkerTimeout on its own.
+	BatchTimeout int `yaml:"batch_timeout"`
+	// MaxStdoutBytes and MaxStderrBytes cap the output kept per run, a run
+	// exceeding either is killed. 0 after InitConfig means no cap, which is
+	// configured with a negative value.
+	MaxStdoutBytes int `yaml:"max_stdout_bytes"`
+	MaxStderrBytes int `yaml:"max_stderr_bytes"`
+	// CodeCacheMaxBytes bounds the compiled artifacts kept per language.
+	CodeCacheMaxBytes int    `yaml:"code_cache_max_bytes"`
+	PythonPath        string `yaml:"python_path"`
 	// PythonLibPaths is internal-only. InitConfig derives it from PythonPath at
 	// startup, and legacy python_lib_path / PYTHON_LIB_PATH user inputs are
 	// intentionally ignored.
@@ -21,7 +31,40 @@ type DifySandboxGlobalConfigurations struct {
 	EnablePreload            bool     `yaml:"enable_preload"`
 	AllowedSyscalls          []int    `yaml:"allowed_syscalls"`
 	LogPath                  string   `yaml:"log_path"`
-	Proxy                    struct {
+	// PythonZygote enables warm, pre-forked python interpreters. Requests
+	// without preload are forked from a root-owned zygote that already
+	// imported the dependency set instead of starting a fresh interpreter.
+	PythonZygote struct {
+		Enabled  bool `yaml:"enabled"`
+		PoolSize int  `yaml:"pool_size"`
+		MaxForks int  `yaml:"max_forks"`
+	} `yaml:"python_zygote"`
+	// Scheduler admits run requests into max_workers. Requests queue per
+	// tenant and are served round robin, a request is shed once it cannot
+	// start within MaxQueueWait seconds, or early enough to finish within the
+	// client timeout sent in TimeoutHeader.
+	Scheduler struct {
+		MaxQueueWait    int            `yaml:"max_queue_wait"`
+		TenantHeader    string         `yaml:"tenant_header"`
+		TimeoutHeader   string         `yaml:"timeout_header"`
+		LanguageWorkers map[string]int `yaml:"language_workers"`
+		Adaptive        bool           `yaml:"adaptive"`
+	} `yaml:"scheduler"`
+	// Cgroup places every sandbox process into its own cgroup v2 leaf with
+	// the limits below, a zero limit is not applied. Without cgroup v2 runs
+	// are only limited by worker_timeout.
+	Cgroup struct {
+		Enabled bool `yaml:"enabled"`
+		// Root is the cgroup the leaves are created in, it defaults to the
+		// cgroup of the server.
+		Root string `yaml:"root"`
+		// MemoryMax is in bytes, CPUMax in cpus, e.g. 0.5
+		MemoryMax int64   `yaml:"memory_max"`
+		CPUMax    float64 `yaml:"cpu_max"`
+		PidsMax   int     `yaml:"pids_max"`
+		Cpuset    string  `yaml:"cpuset"`
+	} `yaml:"cgroup"`
+	Proxy struct {
 		Socks5 string `yaml:"socks5"`
 		Https  string `yaml:"https"`
 		Http   string `yaml:"http"`
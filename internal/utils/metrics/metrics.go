@@ -0,0 +1,266 @@
+package metrics
+
+import (
+	"bufio"
+	"io"
+	"math"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+)
+
+// Collector is a metric family which can write itself in the Prometheus text
+// exposition format.
+type Collector interface {
+	Name() string
+	write(w *bufio.Writer)
+}
+
+type Registry struct {
+	lock       sync.Mutex
+	collectors map[string]Collector
+}
+
+func NewRegistry() *Registry {
+	return &Registry{collectors: map[string]Collector{}}
+}
+
+// DefaultRegistry is served on /metrics.
+var DefaultRegistry = NewRegistry()
+
+// Register adds c, a collector registered under the same name is replaced.
+func (r *Registry) Register(c Collector) {
+	r.lock.Lock()
+	defer r.lock.Unlock()
+	r.collectors[c.Name()] = c
+}
+
+// WriteText writes every collector sorted by name.
+func (r *Registry) WriteText(w io.Writer) error {
+	r.lock.Lock()
+	collectors := make([]Collector, 0, len(r.collectors))
+	for _, c := range r.collectors {
+		collectors = append(collectors, c)
+	}
+	r.lock.Unlock()
+
+	sort.Slice(collectors, func(i, j int) bool {
+		return collectors[i].Name() < collectors[j].Name()
+	})
+
+	writer := bufio.NewWriter(w)
+	for _, c := range collectors {
+		c.write(writer)
+	}
+	return writer.Flush()
+}
+
+func register[T Collector](c T) T {
+	DefaultRegistry.Register(c)
+	return c
+}
+
+// series holds the labelled children of a metric family, keyed by their
+// joined label values.
+type series[T any] struct {
+	lock   sync.Mutex
+	labels []string
+	values map[string]*labelled[T]
+}
+
+type labelled[T any] struct {
+	labelValues []string
+	value       T
+}
+
+func newSeries[T any](labels []string) series[T] {
+	return series[T]{labels: labels, values: map[string]*labelled[T]{}}
+}
+
+// with runs fn on the child for labelValues under the family lock.
+func (s *series[T]) with(labelValues []string, fn func(*T)) {
+	if len(labelValues) != len(s.labels) {
+		panic("metrics: wrong number of label values")
+	}
+
+	key := strings.Join(labelValues, "\xff")
+
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	child, ok := s.values[key]
+	if !ok {
+		child = &labelled[T]{labelValues: append([]string(nil), labelValues...)}
+		s.values[key] = child
+	}
+	fn(&child.value)
+}
+
+// each runs fn for every child sorted by label values.
+func (s *series[T]) each(fn func(labelValues []string, value *T)) {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	keys := make([]string, 0, len(s.values))
+	for key := range s.values {
+		keys = append(keys, key)
+	}
+	sort.Strings(keys)
+
+	for _, key := range keys {
+		child := s.values[key]
+		fn(child.labelValues, &child.value)
+	}
+}
+
+type CounterVec struct {
+	name string
+	help string
+	series[float64]
+}
+
+func NewCounterVec(name string, help string, labels ...string) *CounterVec {
+	return &CounterVec{name: name, help: help, series: newSeries[float64](labels)}
+}
+
+func (c *CounterVec) Name() string {
+	return c.name
+}
+
+func (c *CounterVec) Add(v float64, labelValues ...string) {
+	c.with(labelValues, func(value *float64) {
+		*value += v
+	})
+}
+
+func (c *CounterVec) Inc(labelValues ...string) {
+	c.Add(1, labelValues...)
+}
+
+func (c *CounterVec) write(w *bufio.Writer) {
+	writeHeader(w, c.name, c.help, "counter")
+	c.each(func(labelValues []string, value *float64) {
+		writeSample(w, c.name, c.labels, labelValues, *value)
+	})
+}
+
+type histogram struct {
+	counts []uint64
+	count  uint64
+	sum    float64
+}
+
+type HistogramVec struct {
+	name    string
+	help    string
+	buckets []float64
+	series[histogram]
+}
+
+// NewHistogramVec creates a histogram with the given upper bounds, which must
+// be sorted. The +Inf bucket is implicit.
+func NewHistogramVec(name string, help string, buckets []float64, labels ...string) *HistogramVec {
+	return &HistogramVec{
+		name:    name,
+		help:    help,
+		buckets: buckets,
+		series:  newSeries[histogram](labels),
+	}
+}
+
+func (h *HistogramVec) Name() string {
+	return h.name
+}
+
+func (h *HistogramVec) Observe(v float64, labelValues ...string) {
+	h.with(labelValues, func(value *histogram) {
+		if value.counts == nil {
+			value.counts = make([]uint64, len(h.buckets))
+		}
+		i := sort.SearchFloat64s(h.buckets, v)
+		if i < len(h.buckets) {
+			value.counts[i]++
+		}
+		value.count++
+		value.sum += v
+	})
+}
+
+func (h *HistogramVec) write(w *bufio.Writer) {
+	writeHeader(w, h.name, h.help, "histogram")
+	labels := append(append([]string(nil), h.labels...), "le")
+	h.each(func(labelValues []string, value *histogram) {
+		bucketValues := make([]string, len(labelValues)+1)
+		copy(bucketValues, labelValues)
+
+		cumulative := uint64(0)
+		for i, bound := range h.buckets {
+			cumulative += value.counts[i]
+			bucketValues[len(labelValues)] = formatFloat(bound)
+			writeSample(w, h.name+"_bucket", labels, bucketValues, float64(cumulative))
+		}
+		bucketValues[len(labelValues)] = "+Inf"
+		writeSample(w, h.name+"_bucket", labels, bucketValues, float64(value.count))
+		writeSample(w, h.name+"_sum", h.labels, labelValues, value.sum)
+		writeSample(w, h.name+"_count", h.labels, labelValues, float64(value.count))
+	})
+}
+
+// GaugeFunc reports the value of fn at scrape time.
+type GaugeFunc struct {
+	name string
+	help string
+	fn   func() float64
+}
+
+func NewGaugeFunc(name string, help string, fn func() float64) *GaugeFunc {
+	return &GaugeFunc{name: name, help: help, fn: fn}
+}
+
+func (g *GaugeFunc) Name() string {
+	return g.name
+}
+
+func (g *GaugeFunc) write(w *bufio.Writer) {
+	writeHeader(w, g.name, g.help, "gauge")
+	writeSample(w, g.name, nil, nil, g.fn())
+}
+
+func writeHeader(w *bufio.Writer, name string, help string, kind string) {
+	w.WriteString("# HELP " + name + " " + helpEscaper.Replace(help) + "\n")
+	w.WriteString("# TYPE " + name + " " + kind + "\n")
+}
+
+var helpEscaper = strings.NewReplacer(`\`, `\\`, "\n", `\n`)
+
+var labelValueEscaper = strings.NewReplacer(`\`, `\\`, `"`, `\"`, "\n", `\n`)
+
+func writeSample(w *bufio.Writer, name string, labels []string, labelValues []string, value float64) {
+	w.WriteString(name)
+	if len(labels) > 0 {
+		w.WriteByte('{')
+		for i, label := range labels {
+			if i > 0 {
+				w.WriteByte(',')
+			}
+			w.WriteString(label + `="` + labelValueEscaper.Replace(labelValues[i]) + `"`)
+		}
+		w.WriteByte('}')
+	}
+	w.WriteByte(' ')
+	w.WriteString(formatFloat(value))
+	w.WriteByte('\n')
+}
+
+func formatFloat(v float64) string {
+	switch {
+	case math.IsInf(v, 1):
+		return "+Inf"
+	case math.IsInf(v, -1):
+		return "-Inf"
+	case math.IsNaN(v):
+		return "NaN"
+	}
+	return strconv.FormatFloat(v, 'g', -1, 64)
+}
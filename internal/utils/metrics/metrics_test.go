@@ -0,0 +1,50 @@
+package metrics
+
+import (
+	"bytes"
+	"testing"
+)
+
+func TestRegistryWritesPrometheusText(t *testing.T) {
+	registry := NewRegistry()
+
+	counter := NewCounterVec("test_total", "A counter.", "language")
+	counter.Inc("python3")
+	counter.Add(2, "python3")
+	counter.Inc(`no"de`)
+	registry.Register(counter)
+
+	histogram := NewHistogramVec("test_seconds", "A histogram.", []float64{0.1, 1}, "language")
+	histogram.Observe(0.05, "python3")
+	histogram.Observe(0.5, "python3")
+	histogram.Observe(5, "python3")
+	registry.Register(histogram)
+
+	registry.Register(NewGaugeFunc("test_depth", "A gauge.", func() float64 {
+		return 4
+	}))
+
+	var buf bytes.Buffer
+	if err := registry.WriteText(&buf); err != nil {
+		t.Fatal(err)
+	}
+
+	expected := `# HELP test_depth A gauge.
+# TYPE test_depth gauge
+test_depth 4
+# HELP test_seconds A histogram.
+# TYPE test_seconds histogram
+test_seconds_bucket{language="python3",le="0.1"} 1
+test_seconds_bucket{language="python3",le="1"} 2
+test_seconds_bucket{language="python3",le="+Inf"} 3
+test_seconds_sum{language="python3"} 5.55
+test_seconds_count{language="python3"} 3
+# HELP test_total A counter.
+# TYPE test_total counter
+test_total{language="no\"de"} 1
+test_total{language="python3"} 3
+`
+	if buf.String() != expected {
+		t.Fatalf("unexpected exposition:\n%s", buf.String())
+	}
+}
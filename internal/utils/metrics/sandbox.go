@@ -0,0 +1,102 @@
+package metrics
+
+import "time"
+
+const (
+	LanguagePython3 = "python3"
+	LanguageNodeJs  = "nodejs"
+)
+
+// Phases of a run in the order they happen, see ObservePhase.
+const (
+	// waiting for a slot in the max_workers limit
+	PhaseWorkerWait = "worker_wait"
+	// waiting for a free sandbox UID
+	PhaseUIDWait = "uid_wait"
+	// writing the bootstrap, preparing the rootfs or reserving a zygote
+	PhasePrepare = "prepare"
+	// starting or forking the process
+	PhaseStart = "start"
+	// from start until the sandbox is in place and user code begins
+	PhaseSeccomp = "seccomp"
+	// user code until the process closed its output
+	PhaseRun = "run"
+	// reaping the process and handing the collected output over
+	PhaseOutput = "output"
+)
+
+var durationBuckets = []float64{
+	0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30,
+}
+
+var rssBuckets = []float64{
+	8 << 20, 16 << 20, 32 << 20, 64 << 20, 128 << 20, 256 << 20, 512 << 20, 1 << 30, 2 << 30,
+}
+
+var syncBuckets = []float64{
+	0.01, 0.05, 0.1, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300,
+}
+
+var (
+	RunPhaseSeconds = register(NewHistogramVec(
+		"dify_sandbox_run_phase_seconds",
+		"Time spent in each phase of a sandbox run.",
+		durationBuckets, "language", "phase",
+	))
+	RunTimeouts = register(NewCounterVec(
+		"dify_sandbox_run_timeouts_total",
+		"Sandbox processes killed after exceeding their timeout.",
+		"language",
+	))
+	SeccompKills = register(NewCounterVec(
+		"dify_sandbox_seccomp_kills_total",
+		"Sandbox processes killed by the seccomp filter with a bad system call.",
+		"language",
+	))
+	OOMKills = register(NewCounterVec(
+		"dify_sandbox_oom_kills_total",
+		"Sandbox processes killed after exceeding the memory limit of their cgroup.",
+		"language",
+	))
+	CodeCacheHits = register(NewCounterVec(
+		"dify_sandbox_code_cache_hits_total",
+		"Runs which used the cached compiled artifact of their code.",
+		"language",
+	))
+	CodeCacheMisses = register(NewCounterVec(
+		"dify_sandbox_code_cache_misses_total",
+		"Runs which had to compile their code in the sandbox.",
+		"language",
+	))
+	CPUSeconds = register(NewCounterVec(
+		"dify_sandbox_cpu_seconds_total",
+		"CPU time used by sandbox processes.",
+		"language", "mode",
+	))
+	MaxRSSBytes = register(NewHistogramVec(
+		"dify_sandbox_max_rss_bytes",
+		"Peak resident set size of sandbox processes.",
+		rssBuckets, "language",
+	))
+	EnvSyncSeconds = register(NewHistogramVec(
+		"dify_sandbox_env_sync_seconds",
+		"Time spent syncing the sandbox environment, including syncs without changes.",
+		syncBuckets, "language",
+	))
+	EnvSyncFiles = register(NewCounterVec(
+		"dify_sandbox_env_sync_files_total",
+		"Files placed into new sandbox environment generations, linked or copied from their source or reused from the previous generation.",
+		"language", "action",
+	))
+)
+
+func ObservePhase(language string, phase string, duration time.Duration) {
+	RunPhaseSeconds.Observe(duration.Seconds(), language, phase)
+}
+
+// ObserveUsage records the resource usage of a finished sandbox process.
+func ObserveUsage(language string, userTime time.Duration, systemTime time.Duration, maxRSS int64) {
+	CPUSeconds.Add(userTime.Seconds(), language, "user")
+	CPUSeconds.Add(systemTime.Seconds(), language, "system")
+	MaxRSSBytes.Observe(float64(maxRSS), language)
+}
@@ -0,0 +1,69 @@
+package integrationtests_test
+
+import (
+	"context"
+	"fmt"
+	"strings"
+	"testing"
+
+	"github.com/langgenius/dify-sandbox/internal/core/runner/types"
+	"github.com/langgenius/dify-sandbox/internal/service"
+	types_config "github.com/langgenius/dify-sandbox/internal/types"
+)
+
+// largeSnippet generates code with long literal tables, like templates which
+// embed big constants, the last line prints the result.
+func largeSnippet(declare string, last string) string {
+	var builder strings.Builder
+	for i := 0; i < 2000; i++ {
+		items := make([]string, 40)
+		for j := range items {
+			items[j] = fmt.Sprintf("'item-%d-%d'", i, j)
+		}
+		builder.WriteString(fmt.Sprintf(declare, i, strings.Join(items, ", ")))
+		builder.WriteByte('\n')
+	}
+	builder.WriteString(last)
+	return builder.String()
+}
+
+// benchmarkCodeCache runs the same snippet over and over, and a snippet with
+// a unique trailing comment per iteration which never hits the cache.
+func benchmarkCodeCache(b *testing.B, code string, comment string, run func(string) *types_config.DifySandboxResponse) {
+	check := func(resp *types_config.DifySandboxResponse) {
+		if resp.Code != 0 {
+			b.Fatal(resp)
+		}
+		if data := resp.Data.(*service.RunCodeResponse); data.ExitCode != 0 {
+			b.Fatalf("unexpected failure: %s", data.Error)
+		}
+	}
+
+	b.Run("cached", func(b *testing.B) {
+		check(run(code))
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			check(run(code))
+		}
+	})
+
+	b.Run("uncached", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			check(run(fmt.Sprintf("%s\n%s %d\n", code, comment, i)))
+		}
+	})
+}
+
+func BenchmarkPythonLargeSnippetCodeCache(b *testing.B) {
+	code := largeSnippet("data_%d = [%s]", "print(len(data_1999))\n")
+	benchmarkCodeCache(b, code, "#", func(code string) *types_config.DifySandboxResponse {
+		return service.RunPython3Code(context.TODO(), code, "", &types.RunnerOptions{})
+	})
+}
+
+func BenchmarkNodejsLargeSnippetCodeCache(b *testing.B) {
+	code := largeSnippet("const data_%d = [%s]", "console.log(data_1999.length)\n")
+	benchmarkCodeCache(b, code, "//", func(code string) *types_config.DifySandboxResponse {
+		return service.RunNodeJsCode(context.TODO(), code, "", &types.RunnerOptions{})
+	})
+}